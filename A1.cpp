@@ -1,6 +1,9 @@
 #include "cgmath.h"		// slee's simple math library
 #include "cgut.h"		// slee's OpenGL utility
 #include "circle.h"		// circle class definition
+#include "uniform.h"
+#include "shader_watch.h"
+#include "pacing.h"
 
 //*************************************
 // global constants
@@ -10,6 +13,14 @@ static const char* frag_shader_path = "../bin/shaders/circ.frag";
 uint				NUM_TESS = 100;		// initial tessellation factor of the circle as a polygon
 uint				NUM = 50;		// initial number of circle
 
+//*************************************
+// common structures
+struct uniforms
+{
+	uniform_t	b_solid_color = "b_solid_color", u_time = "u_time", aspect_matrix = "aspect_matrix";
+	uniform_t	solid_color = "solid_color", model_matrix = "model_matrix";
+};
+
 //*************************************
 // window objects
 GLFWwindow* window = nullptr;
@@ -34,6 +45,9 @@ float windrate = window_size.x / float(window_size.y);
 bool	b_wireframe = false;
 #endif
 auto	circles = std::move(create_circles(windrate, NUM));
+uniforms u;
+shader_watch watcher;
+frame_pacer pacer;
 struct {
 	bool add = false, sub = false;
 	operator bool() const {
@@ -48,6 +62,8 @@ std::vector<vertex>	unit_circle_vertices;	// host-side vertices
 //*************************************
 void update()
 {
+	glUseProgram(program);
+
 	t0 = t;
 	t = float(glfwGetTime());
 	u_time = t * 0.3f;
@@ -62,10 +78,9 @@ void update()
 	};
 
 	// update common uniform variables in vertex/fragment shaders
-	GLint uloc;
-	uloc = glGetUniformLocation(program, "b_solid_color");	if (uloc > -1) glUniform1i(uloc, b_solid_color);
-	uloc = glGetUniformLocation(program, "u_time");				if (uloc > -1) glUniform1f(uloc, u_time);
-	uloc = glGetUniformLocation(program, "aspect_matrix");	if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, aspect_matrix);
+	u.b_solid_color.set(b_solid_color);
+	u.u_time.set(u_time);
+	u.aspect_matrix.set(aspect_matrix);
 
 	// update vertex buffer by the pressed keys
 	void update_num(); // forward declaration
@@ -85,9 +100,8 @@ void render()
 		c.update(t, windrate, damping, t - t0);
 
 		// update per-circle uniforms
-		GLint uloc;
-		uloc = glGetUniformLocation(program, "solid_color");		if (uloc > -1) glUniform4fv(uloc, 1, c.color);	// pointer version
-		uloc = glGetUniformLocation(program, "model_matrix");		if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, c.model_matrix);
+		u.solid_color.set(c.color);
+		u.model_matrix.set(c.model_matrix);
 
 		// per-circle draw calls
 		if (b_index_buffer)	glDrawElements(GL_TRIANGLES, NUM_TESS * 3, GL_UNSIGNED_INT, nullptr);
@@ -111,6 +125,8 @@ void print_help()
 	printf("[help]\n");
 	printf("- press ESC or 'q' to terminate the program\n");
 	printf("- press F1 or 'h' to see help\n");
+	printf("- press F5 for frame pacing stats, F6 to cycle the swap interval, F7 to toggle low-latency mode\n");
+	printf("- press F2 to print uniform calls of the last frame\n");
 	printf("- press 'd' to toggle between solid color and texture coordinates\n");
 	printf("- press number(3, 4, 5) to change angle\n");
 	printf("- press 'g' to include gravity\n");
@@ -220,6 +236,8 @@ void keyboard(GLFWwindow* window, int key, int scancode, int action, int mods)
 	{
 		if (key == GLFW_KEY_ESCAPE || key == GLFW_KEY_Q)	glfwSetWindowShouldClose(window, GL_TRUE);
 		else if (key == GLFW_KEY_H || key == GLFW_KEY_F1)	print_help();
+		else if (pacer.keyboard(key))						{}
+		else if (key == GLFW_KEY_F2)	printf("> uniform calls in the last frame: %d issued, %d skipped\n", uniform_stats_last().calls, uniform_stats_last().skipped);
 		else if (key == GLFW_KEY_KP_ADD || (key == GLFW_KEY_EQUAL && (mods & GLFW_MOD_SHIFT))) b.add = true;
 		else if (key == GLFW_KEY_KP_SUBTRACT || key == GLFW_KEY_MINUS) b.sub = true;
 		else if (key == GLFW_KEY_I)
@@ -309,6 +327,8 @@ bool user_init()
 
 void user_finalize()
 {
+	watcher.release();
+	pacer.release();
 }
 
 int main(int argc, char* argv[])
@@ -316,9 +336,12 @@ int main(int argc, char* argv[])
 	// create window and initialize OpenGL extensions
 	if (!(window = cg_create_window(window_name, window_size.x, window_size.y))) { glfwTerminate(); return 1; }
 	if (!cg_init_extensions(window)) { glfwTerminate(); return 1; }	// init OpenGL extensions
+	pacer.parse(argc, argv); pacer.init();
 
 	// initializations and validations of GLSL program
 	if (!(program = cg_create_program(vert_shader_path, frag_shader_path))) { glfwTerminate(); return 1; }	// create and compile shaders/program
+	watcher.add(vert_shader_path, frag_shader_path, &program, [](GLuint p) { resolve_uniforms(p, u); });
+	resolve_uniforms(program, u);
 	if (!user_init()) { printf("Failed to user_init()\n"); glfwTerminate(); return 1; }					// user initialization
 
 	// register event callbacks
@@ -330,9 +353,14 @@ int main(int argc, char* argv[])
 	// enters rendering/event loop
 	for (frame = 0; !glfwWindowShouldClose(window); frame++)
 	{
+		watcher.poll();
+		pacer.wait();
 		glfwPollEvents();	// polling and processing of events
+		pacer.input_sampled();
 		update();			// per-frame update
 		render();			// per-frame render
+		pacer.presented();
+		uniform_frame_end();
 	}
 
 	// normal termination
@@ -2,6 +2,10 @@
 #include "cgut.h"		// slee's OpenGL utility
 #include "sphere.h"		// sphere class definition
 #include "torus.h"		// sphere class definition
+#include "uniform.h"
+#include "shader_watch.h"
+#include "pacing.h"
+#include "sim_clock.h"
 
 //*************************************
 // global constants
@@ -10,6 +14,14 @@ static const char* vert_shader_path = "../bin/shaders/sphere.vert";
 static const char* frag_shader_path = "../bin/shaders/sphere.frag";
 uint				NUM_TESS = 36;
 
+//*************************************
+// common structures
+struct uniforms
+{
+	uniform_t	view_projection_matrix = "view_projection_matrix", color = "color", aspect_matrix = "aspect_matrix";
+	uniform_t	solid_color = "solid_color", model_matrix = "model_matrix", torus_model_matrix = "torus_model_matrix";
+};
+
 //*************************************
 // window objects
 GLFWwindow* window = nullptr;
@@ -29,14 +41,15 @@ uint	Vert = 0;
 uint	Hori = 0;
 uint	tor_Vert = 0;
 uint	tor_Hori = 0;
-float   tmp_time = 0.0f;
-float	theta = 0.0f;
+sim_clock	sim;			// ticked once per frame; the sphere and torus are evaluated at sim.time
 #ifndef GL_ES_VERSION_2_0
 bool	b_wireframe = false;
-bool	b_rotate = false;
 bool	b_torus = false;
 #endif
 auto	spheres = std::move(create_spheres());
+uniforms u;
+shader_watch watcher;
+frame_pacer pacer;
 
 //*************************************
 // holder of vertices and indices of a unit sphere
@@ -46,6 +59,8 @@ std::vector<vertex>	unit_torus_vertices;	// host-side vertices
 //*************************************
 void update()
 {
+	glUseProgram(program);
+
 	float u_time = float(glfwGetTime()) * 0.4f;
 	mat4 view_projection_matrix =
 	{ 0, 1, 0, 0,
@@ -63,10 +78,9 @@ void update()
 	};
 
 	// update common uniform variables in vertex/fragment shaders
-	GLint uloc;
-	uloc = glGetUniformLocation(program, "view_projection_matrix"); if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, view_projection_matrix);
-	uloc = glGetUniformLocation(program, "color");	if (uloc > -1) glUniform1i(uloc, color);
-	uloc = glGetUniformLocation(program, "aspect_matrix");	if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, aspect_matrix);
+	u.view_projection_matrix.set(view_projection_matrix);
+	u.color.set(color);
+	u.aspect_matrix.set(aspect_matrix);
 }
 
 void render()
@@ -79,26 +93,21 @@ void render()
 	sphere_t s;
 	torus_t t;
 	
-	float ro_time = float(glfwGetTime()) - tmp_time;
-	tmp_time = float(glfwGetTime());
-
-	theta += b_rotate ? ro_time : 0;
+	float theta = float(sim.tick(glfwGetTime()));	// one clock sample for the whole frame
 
-	s.update(theta, b_rotate);
+	s.update(theta, !sim.paused);
 	
 	// update per-sphere uniforms
-	GLint uloc;
-	uloc = glGetUniformLocation(program, "solid_color");		if (uloc > -1) glUniform4fv(uloc, 1, s.color);	// pointer version
-	uloc = glGetUniformLocation(program, "model_matrix");		if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, s.model_matrix);
+	u.solid_color.set(s.color);
+	u.model_matrix.set(s.model_matrix);
 	glDrawElements(GL_TRIANGLES, NUM_TESS * NUM_TESS * 12, GL_UNSIGNED_INT, nullptr);
 
 	if (b_torus) {
 		glBindVertexArray(torus_vertex_array);
-		t.update(theta, b_rotate);
+		t.update(theta, !sim.paused);
 
-		GLint uloc;
-		uloc = glGetUniformLocation(program, "solid_color");		if (uloc > -1) glUniform4fv(uloc, 1, t.color);	// pointer version
-		uloc = glGetUniformLocation(program, "torus_model_matrix");		if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, t.torus_model_matrix);
+		u.solid_color.set(t.color);
+		u.torus_model_matrix.set(t.torus_model_matrix);
 		glDrawElements(GL_TRIANGLES, NUM_TESS * NUM_TESS * 12, GL_UNSIGNED_INT, nullptr);
 	}
 
@@ -119,6 +128,8 @@ void print_help()
 	printf("[help]\n");
 	printf("- press ESC or 'q' to terminate the program\n");
 	printf("- press F1 or 'h' to see help\n");
+	printf("- press F5 for frame pacing stats, F6 to cycle the swap interval, F7 to toggle low-latency mode\n");
+	printf("- press F2 to print uniform calls of the last frame\n");
 #ifndef GL_ES_VERSION_2_0
 	printf("- press 'w' to toggle wireframe\n");
 	printf("- press 'r' to rotate sphere\n");
@@ -246,6 +257,8 @@ void keyboard(GLFWwindow* window, int key, int scancode, int action, int mods)
 	{
 		if (key == GLFW_KEY_ESCAPE || key == GLFW_KEY_Q)	glfwSetWindowShouldClose(window, GL_TRUE);
 		else if (key == GLFW_KEY_H || key == GLFW_KEY_F1)	print_help();
+		else if (pacer.keyboard(key))						{}
+		else if (key == GLFW_KEY_F2)	printf("> uniform calls in the last frame: %d issued, %d skipped\n", uniform_stats_last().calls, uniform_stats_last().skipped);
 		else if (key == GLFW_KEY_D)
 		{
 			color = (color + 1) % 4;
@@ -256,8 +269,8 @@ void keyboard(GLFWwindow* window, int key, int scancode, int action, int mods)
 		}
 		else if (key == GLFW_KEY_R)
 		{
-			b_rotate = !b_rotate;
-			printf("> %s\n", b_rotate ? "rotate" : "stop");
+			sim.paused = !sim.paused;
+			printf("> %s\n", sim.paused ? "stop" : "rotate");
 		}
 #ifndef GL_ES_VERSION_2_0
 		else if (key == GLFW_KEY_W)
@@ -293,6 +306,7 @@ bool user_init()
 {
 	// log hotkeys
 	print_help();
+	sim.paused = true;	// 'r' starts the rotation
 
 	// init GL states
 	glLineWidth(1.0f);
@@ -313,6 +327,8 @@ bool user_init()
 
 void user_finalize()
 {
+	watcher.release();
+	pacer.release();
 }
 
 int main(int argc, char* argv[])
@@ -320,9 +336,12 @@ int main(int argc, char* argv[])
 	// create window and initialize OpenGL extensions
 	if (!(window = cg_create_window(window_name, window_size.x, window_size.y))) { glfwTerminate(); return 1; }
 	if (!cg_init_extensions(window)) { glfwTerminate(); return 1; }	// init OpenGL extensions
+	pacer.parse(argc, argv); pacer.init();
 
 	// initializations and validations of GLSL program
 	if (!(program = cg_create_program(vert_shader_path, frag_shader_path))) { glfwTerminate(); return 1; }	// create and compile shaders/program
+	watcher.add(vert_shader_path, frag_shader_path, &program, [](GLuint p) { resolve_uniforms(p, u); });
+	resolve_uniforms(program, u);
 	if (!user_init()) { printf("Failed to user_init()\n"); glfwTerminate(); return 1; }					// user initialization
 
 	// register event callbacks
@@ -334,9 +353,14 @@ int main(int argc, char* argv[])
 	// enters rendering/event loop
 	for (frame = 0; !glfwWindowShouldClose(window); frame++)
 	{
+		watcher.poll();
+		pacer.wait();
 		glfwPollEvents();	// polling and processing of events
+		pacer.input_sampled();
 		update();			// per-frame update
 		render();			// per-frame render
+		pacer.presented();
+		uniform_frame_end();
 	}
 
 	// normal termination
@@ -3,6 +3,11 @@
 #include "sphere.h"		// sphere class definition
 #include "torus.h"
 #include "trackball.h"	// virtual trackball
+#include "uniform.h"
+#include "shader_watch.h"
+#include "pacing.h"
+#include "input_queue.h"
+#include "sim_clock.h"
 
 //*************************************
 // global constants
@@ -28,6 +33,11 @@ struct camera
 	mat4	projection_matrix;
 };
 
+struct uniforms
+{
+	uniform_t	b_solid_color = "b_solid_color", view_matrix = "view_matrix", projection_matrix = "projection_matrix", model_matrix = "model_matrix";
+};
+
 //*************************************
 // window objects
 GLFWwindow* window = nullptr;
@@ -48,11 +58,9 @@ uint	Vert = 0;
 uint	Hori = 0;
 uint	tor_Vert = 0;
 uint	tor_Hori = 0;
-float   tmp_time = 0.0f;
-float	theta = 0.0f;
+sim_clock	sim;			// ticked once per frame; every planet is evaluated at sim.time
 #ifndef GL_ES_VERSION_2_0
 bool	b_wireframe = false;
-bool	b_rotate = true;
 bool	b_torus = false;
 bool	b_solid_color = false;
 bool	shift = false;
@@ -64,6 +72,10 @@ auto	spheres = std::move(create_spheres());
 // scene objects
 camera		cam;
 trackball	tb;
+input_queue	inputs;
+uniforms	u;
+shader_watch watcher;
+frame_pacer pacer;
 
 //*************************************
 // holder of vertices and indices of a unit sphere
@@ -73,6 +85,8 @@ std::vector<vertex>	unit_torus_vertices;	// host-side vertices
 //*************************************
 void update()
 {
+	glUseProgram(program);
+
 	// update projection matrix
 	cam.aspect = window_size.x / float(window_size.y);
 	cam.projection_matrix = mat4::perspective(cam.fovy, cam.aspect, cam.dnear, cam.dfar);
@@ -81,10 +95,9 @@ void update()
 	float t = float(glfwGetTime());
 
 	// update uniform variables in vertex/fragment shaders
-	GLint uloc;
-	uloc = glGetUniformLocation(program, "b_solid_color");			if (uloc > -1) glUniform1i(uloc, b_solid_color);
-	uloc = glGetUniformLocation(program, "view_matrix");			if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, cam.view_matrix);
-	uloc = glGetUniformLocation(program, "projection_matrix");		if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, cam.projection_matrix);
+	u.b_solid_color.set(b_solid_color);
+	u.view_matrix.set(cam.view_matrix);
+	u.projection_matrix.set(cam.projection_matrix);
 }
 
 void render()
@@ -94,16 +107,13 @@ void render()
 	glBindVertexArray(vertex_array);
 
 	torus_t t;
+	float theta = float(sim.tick(glfwGetTime()));	// one clock sample for the whole frame
 
 	for (auto& p : spheres){
-		float ro_time = float(glfwGetTime()) - tmp_time;
-		tmp_time = float(glfwGetTime());
-		theta += b_rotate ? ro_time : 0;
-		p.update(theta, b_rotate);
+		p.update(theta, !sim.paused);
 
 		// update per-sphere uniforms
-		GLint uloc;
-		uloc = glGetUniformLocation(program, "model_matrix");		if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, p.model_matrix);
+		u.model_matrix.set(p.model_matrix);
 		glDrawElements(GL_TRIANGLES, NUM_TESS * NUM_TESS * 12, GL_UNSIGNED_INT, nullptr);
 
 		if (b_torus && p.ring) {
@@ -131,6 +141,9 @@ void print_help()
 	printf("[help]\n");
 	printf("- press ESC or 'q' to terminate the program\n");
 	printf("- press F1 or 'h' to see help\n");
+	printf("- press F3 to print input callbacks and trackball evaluations per frame\n");
+	printf("- press F5 for frame pacing stats, F6 to cycle the swap interval, F7 to toggle low-latency mode\n");
+	printf("- press F2 to print uniform calls of the last frame\n");
 #ifndef GL_ES_VERSION_2_0
 	printf("- press 'w' to toggle wireframe\n");
 	printf("- press 'd' to toggle(tc.xy, 0) > space\n");
@@ -254,13 +267,19 @@ void update_torus_vertex_buffer(const std::vector<vertex>& tor_vertices, uint H,
 	if (!torus_vertex_array) { printf("%s(): failed to create vertex aray\n", __func__); return; }
 }
 
+void apply_input(bool frame = true);
+
 void keyboard(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
+	apply_input(false);
 	if (action == GLFW_PRESS)
 	{
 		if (key == GLFW_KEY_ESCAPE || key == GLFW_KEY_Q)	glfwSetWindowShouldClose(window, GL_TRUE);
 		else if (key == GLFW_KEY_H || key == GLFW_KEY_F1)	print_help();
+		else if (pacer.keyboard(key))						{}
 		else if (key == GLFW_KEY_HOME)					cam = camera();
+		else if (key == GLFW_KEY_F3)	inputs.print_stats();
+		else if (key == GLFW_KEY_F2)	printf("> uniform calls in the last frame: %d issued, %d skipped\n", uniform_stats_last().calls, uniform_stats_last().skipped);
 		else if (key == GLFW_KEY_D)
 		{
 			b_solid_color = !b_solid_color;
@@ -268,8 +287,8 @@ void keyboard(GLFWwindow* window, int key, int scancode, int action, int mods)
 		}
 		else if (key == GLFW_KEY_R)
 		{
-			b_rotate = !b_rotate;
-			printf("> %s\n", b_rotate ? "rotate" : "stop");
+			sim.paused = !sim.paused;
+			printf("> %s\n", sim.paused ? "stop" : "rotate");
 		}
 #ifndef GL_ES_VERSION_2_0
 		else if (key == GLFW_KEY_W)
@@ -293,10 +312,9 @@ void keyboard(GLFWwindow* window, int key, int scancode, int action, int mods)
 	}
 }
 
-void mouse(GLFWwindow* window, int button, int action, int mods)
+void mouse_at(int button, int action, dvec2 pos)
 {
 	if (button == GLFW_MOUSE_BUTTON_LEFT || GLFW_MOUSE_BUTTON_RIGHT || GLFW_MOUSE_BUTTON_MIDDLE) {
-		dvec2 pos; glfwGetCursorPos(window, &pos.x, &pos.y);
 		vec2 npos = cursor_to_ndc(pos, window_size);
 		if (action == GLFW_PRESS)			tb.begin(cam.view_matrix, npos);
 		else if (action == GLFW_RELEASE)	tb.end(cam.eye, cam.at);
@@ -304,16 +322,33 @@ void mouse(GLFWwindow* window, int button, int action, int mods)
 	}
 }
 
-void motion(GLFWwindow* window, double x, double y)
+bool track(dvec2 pos)
 {
-	if (!tb.is_tracking()) return;
-	vec2 npos = cursor_to_ndc(dvec2(x, y), window_size);
+	if (!tb.is_tracking()) return false;
+	vec2 npos = cursor_to_ndc(pos, window_size);
 
 	if (mousebtn == GLFW_MOUSE_BUTTON_LEFT && !shift && !ctrl) cam.view_matrix = tb.update(npos);
 	else if (mousebtn == GLFW_MOUSE_BUTTON_RIGHT || (mousebtn == GLFW_MOUSE_BUTTON_LEFT && shift))
 		cam.view_matrix = tb.zooming(npos, cam.eye, cam.at, cam.up);
 	else if (mousebtn == GLFW_MOUSE_BUTTON_MIDDLE || (mousebtn == GLFW_MOUSE_BUTTON_LEFT && ctrl))
 		cam.view_matrix = tb.panning(npos, cam.eye, cam.at, cam.up);
+	return true;
+}
+
+void apply_input(bool frame)
+{
+	inputs.apply([](const input_queue::event& e) { mouse_at(e.button, e.action, e.pos); }, track, frame);
+}
+
+void mouse(GLFWwindow* window, int button, int action, int mods)
+{
+	dvec2 pos; glfwGetCursorPos(window, &pos.x, &pos.y);
+	inputs.button(button, action, mods, pos);
+}
+
+void motion(GLFWwindow* window, double x, double y)
+{
+	inputs.cursor(dvec2(x, y));
 }
 
 bool user_init()
@@ -340,6 +375,8 @@ bool user_init()
 
 void user_finalize()
 {
+	watcher.release();
+	pacer.release();
 }
 
 int main(int argc, char* argv[])
@@ -347,9 +384,13 @@ int main(int argc, char* argv[])
 	// create window and initialize OpenGL extensions
 	if (!(window = cg_create_window(window_name, window_size.x, window_size.y))) { glfwTerminate(); return 1; }
 	if (!cg_init_extensions(window)) { glfwTerminate(); return 1; }	// init OpenGL extensions
+	for (int i = 1; i < argc; i++) if (strcmp(argv[i], "--per-event-input") == 0) inputs.coalesce = false;
+	pacer.parse(argc, argv); pacer.init();
 
 	// initializations and validations of GLSL program
 	if (!(program = cg_create_program(vert_shader_path, frag_shader_path))) { glfwTerminate(); return 1; }	// create and compile shaders/program
+	watcher.add(vert_shader_path, frag_shader_path, &program, [](GLuint p) { resolve_uniforms(p, u); });
+	resolve_uniforms(program, u);
 	if (!user_init()) { printf("Failed to user_init()\n"); glfwTerminate(); return 1; }					// user initialization
 
 	// register event callbacks
@@ -361,9 +402,15 @@ int main(int argc, char* argv[])
 	// enters rendering/event loop
 	for (frame = 0; !glfwWindowShouldClose(window); frame++)
 	{
+		watcher.poll();
+		pacer.wait();
 		glfwPollEvents();	// polling and processing of events
+		pacer.input_sampled();
+		apply_input();
 		update();			// per-frame update
 		render();			// per-frame render
+		pacer.presented();
+		uniform_frame_end();
 	}
 
 	// normal termination
@@ -5,6 +5,28 @@
 #include "torus.h"
 #include "trackball.h"
 #include "satellite.h"
+#include "texture.h"
+#include "uniform.h"
+#include "batch.h"
+#include "render_queue.h"
+#include "frustum.h"
+#include "scene.h"
+#include "snapshot.h"
+#include "profiler.h"
+#include "offscreen.h"
+#include "replay.h"
+#include "shader.h"
+#include "shader_watch.h"
+#include "sim_clock.h"
+#include "pacing.h"
+#include "input_queue.h"
+#include "ephemeris.h"
+#include "belt.h"
+#include "starfield.h"
+#include <chrono>
+#include <future>
+#include <random>
+#include <thread>
 
 //*************************************
 // global constants
@@ -14,12 +36,93 @@ static const char* frag_shader_path = "../bin/shaders/texphong.frag";
 static const char* mesh_texture_path[9] = {"../bin/textures/sun.jpg", "../bin/textures/mercury.jpg","../bin/textures/venus.jpg", "../bin/textures/earth.jpg", "../bin/textures/mars.jpg",
 											"../bin/textures/jupiter.jpg", "../bin/textures/saturn.jpg", "../bin/textures/uranus.jpg", "../bin/textures/neptune.jpg"};
 static const char* mesh_normal_texture_path[9] = {"../bin/textures/sun.jpg", "../bin/textures/mercury-normal.jpg","../bin/textures/venus-normal.jpg", "../bin/textures/earth-normal.jpg", "../bin/textures/mars-normal.jpg",
-											"../bin/textures/jupiter.jpg", "../bin/textures/saturn.jpg", "../bin/textures/uranus.jpg", "../bin/textures/neptune.jpg"};
+											nullptr, nullptr, nullptr, nullptr}; // nullptr: no normal map, drawn without normal mapping
+static bool has_normal_map(size_t i) { return i % 9 != 0 && mesh_normal_texture_path[i % 9]; }	// the sun's entry is never sampled
+static const int	SATELLITE_LAYER = 9;		// first satellite layer in the batched color array
 static const char* mesh_ring_texture_path[2] = { "../bin/textures/saturn-ring.jpg", "../bin/textures/uranus-ring.jpg" };
 static const char* mesh_ring_alpha_texture_path[2] = { "../bin/textures/saturn-ring-alpha.jpg", "../bin/textures/uranus-ring-alpha.jpg" };
 static const char* mesh_satellite_texture_path[4] = { "../bin/textures/moon.jpg", "../bin/textures/mercury.jpg",  "../bin/textures/mercury.jpg",  "../bin/textures/mercury.jpg" }; // instead of jupiter's satellite
 uint				NUM_TESS = 36;
 
+//*************************************
+// Phong permutations of the per-object path: features are compiled in instead of branching on
+// SUN/EARTH uniforms; reads the shared Camera/Light/Material blocks of uniform.h
+enum { VARIANT_UNLIT = 1, VARIANT_NORMAL_MAP = 2, VARIANT_ALPHA_MAP = 4 };
+static const char* variant_features[] = { "UNLIT", "NORMAL_MAP", "ALPHA_MAP" };
+
+static const char* variant_vert_source = R"(
+#version 330
+layout(location=0) in vec3 position;
+layout(location=1) in vec3 normal;
+layout(location=2) in vec2 texcoord;
+
+layout(std140, row_major) uniform Camera { mat4 view_matrix; mat4 projection_matrix; };
+uniform mat4 model_matrix;
+
+out vec3 epos;
+out vec3 enorm;
+out vec2 tc;
+#ifdef NORMAL_MAP
+out vec3 etan;
+#endif
+
+void main()
+{
+	mat4 model_view = view_matrix*model_matrix;
+	vec4 ep = model_view*vec4(position,1);
+	epos = ep.xyz;
+	enorm = normalize(mat3(model_view)*normal);
+#ifdef NORMAL_MAP
+	etan = mat3(model_view)*vec3(-normal.y,normal.x,0.0001);	// along increasing longitude
+#endif
+	tc = texcoord;
+	gl_Position = projection_matrix*ep;
+}
+)";
+
+static const char* variant_frag_source = R"(
+#version 330
+in vec3 epos;
+in vec3 enorm;
+in vec2 tc;
+#ifdef NORMAL_MAP
+in vec3 etan;
+uniform sampler2D NORM;
+#endif
+out vec4 fragColor;
+
+layout(std140, row_major) uniform Camera { mat4 view_matrix; mat4 projection_matrix; };
+layout(std140) uniform Light { vec4 light_position, Ia, Id, Is; };
+layout(std140) uniform Material { vec4 Ka, Kd, Ks; float shininess; };
+uniform sampler2D TEX;
+uniform float alpha;
+
+void main()
+{
+	vec4 albedo = texture( TEX, tc );
+#ifdef ALPHA_MAP
+	float a = albedo.a*alpha;
+#else
+	float a = alpha;
+#endif
+#ifdef UNLIT
+	fragColor = vec4(albedo.rgb,a);
+#else
+	vec3 n = normalize(enorm);
+#ifdef NORMAL_MAP
+	vec3 t = normalize(etan-dot(etan,n)*n), b = cross(n,t);
+	n = normalize(mat3(t,b,n)*(texture( NORM, tc ).xyz*2.0-1.0));
+#endif
+	vec3 l = normalize((view_matrix*light_position).xyz-epos);
+	vec3 h = normalize(l+normalize(-epos));
+	vec4 Ira = Ka*Ia;
+	vec4 Ird = max(Kd*dot(l,n)*Id,0.0);
+	vec4 Irs = max(Ks*pow(max(dot(h,n),0.0),shininess)*Is,0.0);
+	fragColor = vec4((albedo*(Ira+Ird)+Irs).rgb,a);
+#endif
+}
+)";
+
 //*************************************
 // common structures
 struct camera
@@ -52,6 +155,19 @@ struct material_t
 	float	shininess = 1000.0f;
 };
 
+struct variant_uniforms
+{
+	uniform_t	model_matrix = "model_matrix", alpha = "alpha", TEX = "TEX", NORM = "NORM";
+};
+
+struct uniforms
+{
+	uniform_t	view_matrix = "view_matrix", projection_matrix = "projection_matrix", model_matrix = "model_matrix";
+	uniform_t	light_position = "light_position", Ia = "Ia", Id = "Id", Is = "Is";
+	uniform_t	Ka = "Ka", Kd = "Kd", Ks = "Ks", shininess = "shininess";
+	uniform_t	TEX = "TEX", NORM = "NORM", SUN = "SUN", EARTH = "EARTH", alpha = "alpha";
+};
+
 //*************************************
 // window objects
 GLFWwindow* window = nullptr;
@@ -62,34 +178,36 @@ ivec2		window_size = cg_default_window_size(); //ivec2(1280, 720);
 GLuint program = 0;
 GLuint vertex_array = 0;
 GLuint torus_vertex_array = 0;
+GLuint vertex_buffer = 0;
+GLuint torus_vertex_buffer = 0;
 GLuint sate_vertex_array = 0;
 GLuint PLANETTEX[9] = { 0 };
 GLuint PLANETNORMTEX[9] = { 0 };
-GLuint RINGTEX[2] = { 0 };
-GLuint RINGALPHATEX[2] = { 0 };
+GLuint RINGTEX[2] = { 0 };		// RGBA: ring color packed with its alpha map
 GLuint SATELLITE[4] = { 0 };
 
 //*************************************
 // global variables
 int		frame = 0;
 int 	color = 0;
-int		k = 0;
-int		r = 0;
-int		s = 0;
 int		mousebtn = -1;
 uint	Vert = 0;
 uint	Hori = 0;
 uint	tor_Vert = 0;
 uint	tor_Hori = 0;
-float   tmp_time = 0.0f;
-float	theta = 0.0f;
+int		max_texture_dim = 0;	// max texture width/height; derived from the window size at init
 #ifndef GL_ES_VERSION_2_0
 bool	b_wireframe = false;
-bool	b_rotate = true;
 bool	shift = false;
 bool	ctrl = false;
 bool	b_normal = false;
+bool	b_batch = false;		// draw all bodies with instanced calls
+bool	b_cull = true;			// skip bodies outside the view frustum
+bool	b_variants = true;		// per-object path draws with shader permutations instead of texphong
 #endif
+double	submit_time[2] = { 0, 0 };	// CPU submit time of the last frame: [0] per-object loop, [1] batched
+float	sphere_bound = 1.0f;	// bounding radius of the sphere mesh in model space
+float	torus_bound = 1.0f;		// bounding radius of the ring mesh in model space
 auto	spheres = std::move(create_spheres());
 auto	satellites = std::move(create_satellite());
 
@@ -97,12 +215,73 @@ auto	satellites = std::move(create_satellite());
 // scene objects
 camera cam;
 trackball tb;
+input_queue	inputs;
 light_t		light;
 material_t	material;
+uniforms	u;
+shader_watch	watcher;
+frame_pacer		pacer;
+uniform_block_t<camera_block>	camera_ubo("Camera", CAMERA_BLOCK);
+uniform_block_t<light_block>	light_ubo("Light", LIGHT_BLOCK);
+uniform_block_t<material_block>	material_ubo("Material", MATERIAL_BLOCK);
+texture_uploader uploader;
+struct batch_images_t { std::vector<image*> colors, normals, rings; };
+std::future<batch_images_t> batch_reload;	// texture arrays re-streamed by 'u', in decoding
+batch_images_t load_batch_images();
+bool create_batch_textures(batch_images_t b);
+batch_renderer batch;
+render_queue queue;		// sorted draws of the per-object path
+shader_variants<variant_uniforms> variants(variant_vert_source, variant_frag_source, variant_features, 3);
+frustum_t	frustum;
+cull_set	systems;		// a planet with its ring and satellites
+cull_set	bodies;			// planets, rings and satellites of visible systems
+std::vector<int> cull_index;	// per planet: its first entry in bodies, or -1 when its system is culled
+scene_graph	scene;			// root -> planets -> rings and satellites
+std::vector<int> planet_node;	// per planet: its scene node, followed by its ring's and satellites' nodes
+struct system_layout_t { bool ring = false; int satellites = 0; float reach = 1.0f; };	// reach: bounding radius in the planet's model space
+std::vector<system_layout_t> system_layout;	// per planet: copied from spheres by build_scene(), so the render thread never reads spheres
+std::vector<float> planet_theta;	// per planet: theta of its last update()
+asteroid_belt	belt;			// between Mars and Jupiter; positioned on the GPU from frame_clock
+int			belt_count = 200000;	// --belt <n>; 0: no belt
+starfield	sky;			// stars at infinity, drawn before the scene
+uint32_t	star_count = 1000000;	// --stars <n>: stars generated when no catalogue is given; 0: no stars
+const char*	star_path = nullptr;	// --star-catalogue <file>: loaded, or generated and saved when missing
+
+//*************************************
+// simulation thread: owns spheres, scene and the clock after user_init(), and publishes
+// a snapshot per step; the render thread interpolates the last two
+static const double	sim_step = 1.0 / 120.0;	// seconds per simulation step
+sim_clock			sim;					// orbits are evaluated at sim.time; ticked once per step
+std::thread			sim_thread;
+std::atomic<bool>	sim_running{ false };
+triple_buffer<scene_snapshot> snapshots;
+scene_snapshot		snap_prev, snap_curr;	// render thread's copies of the last two snapshots
+std::vector<mat4>	frame_world;			// world matrices interpolated for this frame
+double				frame_clock = 0;		// simulation clock interpolated for this frame
+
+//*************************************
+// lockstep modes (headless, record, replay) step the simulation once per frame on a fixed clock,
+// instead of running the simulation thread on the wall clock
+bool	b_headless = false;		// a hidden window renders a fixed camera path offscreen
+bool	b_lockstep = false;
+double	fixed_time = -1.0;		// simulation clock of lockstep frames; negative: wall clock
+static const double frame_step = 1.0 / 60.0;	// simulation seconds per lockstep frame
+input_recorder	recorder;		// --record: input events and frame clocks to a file
+render_target*	scene_target = nullptr;	// when set, the scene is drawn offscreen, then blitted to the window
+
+//*************************************
+// dynamic resolution: the scene is drawn into a scaled region of an offscreen target
+bool	b_dynres = false;
+render_target			dynres_target;
+resolution_controller	dynres;
+
+double clock_now() { return fixed_time >= 0 ? fixed_time : glfwGetTime(); }
 
 //*************************************
 void update()
 {
+	glUseProgram(program);
+
 	// update projection matrix
 	cam.aspect = window_size.x / float(window_size.y);
 	cam.projection_matrix = mat4::perspective(cam.fovy, cam.aspect, cam.dnear, cam.dfar);
@@ -110,96 +289,314 @@ void update()
 	// build the model matrix for oscillating scale
 	float t = float(glfwGetTime());
 
-	// update uniform variables in vertex/fragment shaders
-	GLint uloc;
-	uloc = glGetUniformLocation(program, "view_matrix");			if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, cam.view_matrix);
-	uloc = glGetUniformLocation(program, "projection_matrix");		if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, cam.projection_matrix);
+	// stage pending texture uploads and retire finished ones
+	uploader.update();
+	if (uploader.stats.textures) printf("> uploaded %d texture(s), %.1f MB in %.2f ms\n", uploader.stats.textures, uploader.stats.bytes / 1048576.0, uploader.stats.time * 1000.0);
+	if (batch_reload.valid() && batch_reload.wait_for(std::chrono::seconds(0)) == std::future_status::ready && create_batch_textures(batch_reload.get())) printf("> re-streamed the batched texture arrays\n");
+
+	// update uniform blocks; each is uploaded only when its contents changed
+	camera_ubo.set({ cam.view_matrix, cam.projection_matrix });
+	light_ubo.set({ light.position, light.ambient, light.diffuse, light.specular });
+	material_ubo.set({ material.ambient, material.diffuse, material.specular, material.shininess });
+	camera_ubo.update();
+	light_ubo.update();
+	material_ubo.update();
+
+	// update uniform variables in vertex/fragment shaders; no-ops for members of the blocks above
+	u.view_matrix.set(cam.view_matrix);
+	u.projection_matrix.set(cam.projection_matrix);
 
 	// setup light properties
-	glUniform4fv(glGetUniformLocation(program, "light_position"), 1, light.position);
-	glUniform4fv(glGetUniformLocation(program, "Ia"), 1, light.ambient);
-	glUniform4fv(glGetUniformLocation(program, "Id"), 1, light.diffuse);
-	glUniform4fv(glGetUniformLocation(program, "Is"), 1, light.specular);
+	u.light_position.set(light.position);
+	u.Ia.set(light.ambient);
+	u.Id.set(light.diffuse);
+	u.Is.set(light.specular);
 
 	// setup material properties
-	glUniform4fv(glGetUniformLocation(program, "Ka"), 1, material.ambient);
-	glUniform4fv(glGetUniformLocation(program, "Kd"), 1, material.diffuse);
-	glUniform4fv(glGetUniformLocation(program, "Ks"), 1, material.specular);
-	glUniform1f(glGetUniformLocation(program, "shininess"), material.shininess);
+	u.Ka.set(material.ambient);
+	u.Kd.set(material.diffuse);
+	u.Ks.set(material.specular);
+	u.shininess.set(material.shininess);
 }
 
-void render()
+// the sun and planets hang off a root at the origin; rings and satellites off their planets
+void build_scene()
 {
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	scene.clear();
+	planet_node.clear();
+	int root = scene.add(-1);
+	system_layout.clear();
+	for (auto& p : spheres) {
+		int n = scene.add(root, p.model_matrix);
+		planet_node.push_back(n);
+		if (p.ring) scene.add(n);		// the ring shares its planet's transform
+		for (size_t j = 0; j < p.satellite.size(); j++) scene.add(n);
+
+		system_layout_t l;
+		l.ring = p.ring;
+		l.satellites = int(p.satellite.size());
+		l.reach = p.ring ? std::max(sphere_bound, torus_bound) : sphere_bound;
+		for (auto& sate : p.satellite) l.reach = std::max(l.reach, sate.rotat_radius + sate.revol_radius * sphere_bound);
+		system_layout.push_back(l);
+	}
+	planet_theta.assign(spheres.size(), NAN);
+}
+
+// advance the orbits from one clock sample; a planet (and its satellites) is only updated when it has moved
+void animate()
+{
+	float theta = float(sim.tick(clock_now()));
+	bool rotate = !sim.paused;
+	for (size_t i = 0; i < spheres.size(); i++) {
+		auto& p = spheres[i];
+		if (theta == planet_theta[i]) continue;
+		planet_theta[i] = theta;
+		p.update(theta, rotate);
+
+		int n = planet_node[i];
+		scene.set_local(n++, p.model_matrix);
+		if (p.ring) n++;
+		for (auto& sate : p.satellite)
+			scene.set_local(n++, mat4::translate(sate.rotat_radius * cos(theta + sate.phi), sate.rotat_radius * sin(theta + sate.phi), 0) * mat4::rotate( vec3(0.0f, 0.0f, 1.0f), sate.revol_velocity) * mat4::scale(sate.revol_radius));
+	}
+}
+
+// one simulation step: advance the orbits, propagate transforms, and publish the result
+void simulate()
+{
+	PROFILE_THREAD_SCOPE("physics", 1);
+	double t0 = glfwGetTime();
+	animate();
+	scene.update();
+	scene_snapshot& snap = snapshots.write_buffer();
+	snap.time = sim.wall;
+	snap.clock = sim.time;
+	snap.world = scene.world;
+	snap.recomputed = scene.recomputed;
+	snap.cost = glfwGetTime() - t0;
+	snapshots.publish();
+}
+
+void simulation_loop()
+{
+	auto step = std::chrono::microseconds(int64_t(sim_step * 1e6));
+	auto next = std::chrono::steady_clock::now();
+	while (sim_running.load()) {
+		simulate();
+		next += step;
+		auto now = std::chrono::steady_clock::now();
+		if (next < now - step * 10) next = now;		// fell behind (e.g., a stall); don't try to catch up
+		std::this_thread::sleep_until(next);
+	}
+}
+
+// take the newest snapshot, and render one step in the past so that there is always a pair to blend
+void consume_snapshot()
+{
+	if (snapshots.acquire()) { std::swap(snap_prev, snap_curr); snap_curr = snapshots.read_buffer(); }
+	frame_clock = interpolate(snap_prev, snap_curr, clock_now() - sim_step, frame_world);
+}
+
+// cull whole systems first, then each planet, ring and satellite of the visible systems;
+// runs on the render thread, which owns the camera, against the interpolated snapshot
+void cull()
+{
+	frustum.extract(cam.projection_matrix * cam.view_matrix);
+	systems.clear();
+	for (size_t i = 0; i < system_layout.size(); i++) {
+		const mat4& m = frame_world[planet_node[i]];
+		systems.push(matrix_origin(m), system_layout[i].reach * matrix_scale(m));
+	}
+	if (b_cull) systems.test(frustum); else systems.accept_all();
+
+	bodies.clear();
+	cull_index.assign(system_layout.size(), -1);
+	for (size_t i = 0; i < system_layout.size(); i++) {
+		if (!systems.visible[i]) continue;
+		auto& p = system_layout[i];
+		int n = planet_node[i];
+		int last = n + 1 + (p.ring ? 1 : 0) + p.satellites;
+		cull_index[i] = int(bodies.count);
+		for (int k = n; k < last; k++) {
+			const mat4& m = frame_world[k];
+			bodies.push(matrix_origin(m), (p.ring && k == n + 1 ? torus_bound : sphere_bound) * matrix_scale(m));
+		}
+	}
+	if (b_cull) bodies.test(frustum); else bodies.accept_all();
+}
+
+// view-space distance of a model's origin, for depth-sorting the render queue
+float view_depth(const mat4& m)
+{
+	return -(cam.view_matrix * vec4(m._14, m._24, m._34, 1.0f)).z;
+}
+
+// per-object path: every body is pushed to the render queue once, then sorted by state and depth
+void render_legacy()
+{
+	queue.clear();
+	queue.far_depth = cam.dfar;
+	int ring_index = 0, sate_index = 0;
+	for (size_t i = 0; i < system_layout.size(); i++) {
+		auto& p = system_layout[i];
+		int c = cull_index[i];
+		if (c < 0) { ring_index += p.ring ? 1 : 0; sate_index += p.satellites; continue; }
+		int n = planet_node[i], moon_node = n + (p.ring ? 2 : 1);
+		draw_item_t planet;
+		planet.program = program;
+		planet.vertex_array = vertex_array;
+		planet.count = 15552;
+		planet.textures[0] = PLANETTEX[i % 9];
+		planet.textures[1] = PLANETNORMTEX[i % 9];
+		planet.model_matrix = frame_world[n];
+		planet.depth = view_depth(planet.model_matrix);
+		planet.params = vec4(i % 9 == 0 ? 1.0f : 0.0f, b_normal && has_normal_map(i) ? 1.0f : 0.0f, 1.0f, 0.0f);	// sun, earth, alpha, alpha texture
+		if (bodies.visible[c++]) queue.push(planet);
+
+		if (p.ring && !bodies.visible[c++]) ring_index++;
+		else if (p.ring) {
+			// per-texel ring alpha comes from RINGTEX.a, so rings always draw with the alpha-map permutation
+			draw_item_t ring = planet;
+			ring.model_matrix = frame_world[n + 1];
+			ring.vertex_array = torus_vertex_array;
+			ring.count = 15984;
+			ring.textures[0] = RINGTEX[ring_index++ % 2];
+			ring.textures[1] = 0;
+			ring.blend = true;
+			ring.params = vec4(0.0f, 0.0f, 1.0f, 1.0f);
+			queue.push(ring);
+		}
+		for (int j = 0; j < p.satellites; j++) {
+			if (!bodies.visible[c++]) { sate_index++; continue; }
+			draw_item_t moon = planet;
+			moon.textures[0] = SATELLITE[sate_index++ % 4];
+			moon.textures[1] = 0;
+			moon.model_matrix = frame_world[moon_node + j];
+			moon.depth = view_depth(moon.model_matrix);
+			moon.params = vec4(0.0f, 0.0f, 1.0f, 0.0f);
+			queue.push(moon);
+		}
+	}
+
+	// move each item to the permutation of its features (rings always); the queue then sorts draws by variant
+	auto mask = [](const draw_item_t& item) { return uint32_t((item.params.x > 0.5f ? VARIANT_UNLIT : 0) | (item.params.y > 0.5f ? VARIANT_NORMAL_MAP : 0) | (item.params.w > 0.5f ? VARIANT_ALPHA_MAP : 0)); };
+	for (auto& item : queue.items) if (b_variants || item.params.w > 0.5f) { GLuint v = variants.get(mask(item)).program; if (v) item.program = v; }
+
 	glUseProgram(program);
-	glBindVertexArray(vertex_array);
-	
-	bool sun = true;
-	bool earth = true;
-	bool ring = false;
-	for (auto& p : spheres){
-		float ro_time = float(glfwGetTime()) - tmp_time;
-		tmp_time = float(glfwGetTime());
-		theta += b_rotate ? ro_time : 0;
-		p.update(theta, b_rotate);
-
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, PLANETTEX[k % 9]);
-		glUniform1i(glGetUniformLocation(program, "TEX"), 0);
-
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, PLANETNORMTEX[k % 9]);
-		glUniform1i(glGetUniformLocation(program, "NORM"), 1);
-
-		if (k % 9 == 0) sun = true;
-		else sun = false;
-		if (b_normal && (k % 9 == 1 || k % 9 == 2 || k % 9 == 3 || k % 9 == 4)) earth = true;
-		else earth = false;
-		glUniform1i(glGetUniformLocation(program, "SUN"), sun);
-		glUniform1i(glGetUniformLocation(program, "EARTH"), earth);
-		glUniform1f(glGetUniformLocation(program, "alpha"), 1.0f);
-		// update per-sphere uniform
-		GLint uloc;
-		uloc = glGetUniformLocation(program, "model_matrix");		if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, p.model_matrix);
-		glDrawArrays(GL_TRIANGLES, 0, 15552);
-		
-		glEnable(GL_BLEND);
-		if (p.ring) {
-			glUniform1f(glGetUniformLocation(program, "alpha"), 0.5f);
-			glBindVertexArray(torus_vertex_array);
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, RINGTEX[r++ % 2]);
-			glDrawArrays(GL_TRIANGLES, 0, 15984);
-
-			glBindVertexArray(vertex_array);
-			glBindTexture(GL_TEXTURE_2D, PLANETTEX[k % 9]);
-			glDrawArrays(GL_TRIANGLES, 0, 15552);
+	u.TEX.set(0);
+	u.NORM.set(1);
+	queue.submit([&](const draw_item_t& item) {
+		if (item.program != program) {
+			uint32_t m = mask(item);
+			auto& v = variants.get(m).u;
+			v.TEX.set(0);
+			v.NORM.set(1);
+			v.alpha.set(m & VARIANT_ALPHA_MAP ? 1.0f : item.params.z);
+			v.model_matrix.set(item.model_matrix);
+			return;
 		}
-		glDisable(GL_BLEND);
-
-		if (p.satellite.size()) {
-			for (auto& sate : p.satellite) {
-				sate.model_matrix = p.model_matrix * mat4::translate(sate.rotat_radius * cos(theta + sate.phi), sate.rotat_radius * sin(theta + sate.phi), 0) * mat4::rotate( vec3(0.0f, 0.0f, 1.0f), sate.revol_velocity) * mat4::scale(sate.revol_radius);
-				uloc = glGetUniformLocation(program, "model_matrix");		if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, sate.model_matrix);
-				glBindVertexArray(vertex_array);
-				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_2D, SATELLITE[s++ % 4]);
-				glDrawArrays(GL_TRIANGLES, 0, 15552);
-
-				glBindVertexArray(vertex_array);
-				glBindTexture(GL_TEXTURE_2D, PLANETTEX[k % 9]);
-				glDrawArrays(GL_TRIANGLES, 0, 15552);
-			}
+		u.SUN.set(item.params.x > 0.5f);
+		u.EARTH.set(item.params.y > 0.5f);
+		u.alpha.set(item.params.z);
+		u.model_matrix.set(item.model_matrix);
+	});
+}
+
+// batched: every sphere in one instanced draw, and every ring in another
+void render_batched()
+{
+	batch.begin();
+	int ring_index = 0, sate_index = 0;
+	for (size_t i = 0; i < system_layout.size(); i++) {
+		auto& p = system_layout[i];
+		int c = cull_index[i];
+		if (c < 0) { ring_index += p.ring ? 1 : 0; sate_index += p.satellites; continue; }
+		int n = planet_node[i], moon_node = n + (p.ring ? 2 : 1);
+		instance_t planet;
+		planet.model_matrix = frame_world[n];
+		planet.layer = float(i % 9);
+		planet.unlit = i % 9 == 0 ? 1.0f : 0.0f;
+		planet.normal_layer = b_normal && has_normal_map(i) ? float(i % 9) : -1.0f;
+		if (bodies.visible[c++]) batch.spheres.push_back(planet);
+
+		if (p.ring && !bodies.visible[c++]) ring_index++;
+		else if (p.ring) {
+			instance_t ring;
+			ring.model_matrix = frame_world[n + 1];
+			ring.layer = float(ring_index++ % 2);
+			batch.rings.push_back(ring);
+		}
+		for (int j = 0; j < p.satellites; j++) {
+			if (!bodies.visible[c++]) { sate_index++; continue; }
+			instance_t moon;
+			moon.model_matrix = frame_world[moon_node + j];
+			moon.layer = float(SATELLITE_LAYER + sate_index++ % 4);
+			batch.spheres.push_back(moon);
 		}
-		k++;
 	}
+	batch.draw();
+}
+
+// stretch an offscreen target over the window
+void present(const render_target& target)
+{
+	ivec2 fb; glfwGetFramebufferSize(window, &fb.x, &fb.y);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, target.fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, target.used_width, target.used_height, 0, 0, fb.x, fb.y, GL_COLOR_BUFFER_BIT, GL_LINEAR);	// bilinear upscale
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, fb.x, fb.y);
+}
+
+void render()
+{
+	if (b_dynres) {
+		ivec2 fb; glfwGetFramebufferSize(window, &fb.x, &fb.y);
+		if (!scene_target) scene_target = &dynres_target;
+		if (scene_target == &dynres_target && (fb.x != dynres_target.width || fb.y != dynres_target.height) && fb.x > 0 && fb.y > 0) dynres_target.create(fb.x, fb.y);
+		scene_target->set_scale(dynres.scale);
+		dynres.begin_frame();
+	}
+	if (scene_target) scene_target->bind();
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	consume_snapshot();
+
+	// star sprites are sized in window pixels: scale them to the pixels actually drawn (hi-dpi framebuffer, dynamic resolution)
+	ivec2 fb; glfwGetFramebufferSize(window, &fb.x, &fb.y);
+	int drawn_width = scene_target ? scene_target->used_width : fb.x;
+	sky.point_scale = window_size.x > 0 && drawn_width > 0 ? drawn_width / float(window_size.x) : 1.0f;
+	{
+		PROFILE_SCOPE("culling");
+		cull();
+	}
+	{
+		PROFILE_GPU_SCOPE("draw stars");
+		sky.draw(cam.view_matrix, cam.projection_matrix, b_cull);
+	}
+
+	double t0 = glfwGetTime();
+	{
+		PROFILE_GPU_SCOPE("draw submit");	// common to every path, so frames compare across paths
+		PROFILE_SCOPE(b_batch ? "draw batched" : b_variants ? "draw variants" : "draw texphong");
+		if (b_batch) render_batched();
+		else render_legacy();
+	}
+	submit_time[b_batch ? 1 : 0] = glfwGetTime() - t0;
+	{
+		PROFILE_GPU_SCOPE("draw belt");
+		belt.draw(frustum, b_cull, cam.view_matrix, frame_clock);
+	}
+	if (b_dynres && dynres.end_frame()) printf("> resolution scale %.2f (%dx%d), scene %.2f ms for a %.1f ms target\n", dynres.scale, int(scene_target->width * dynres.scale + 0.5f), int(scene_target->height * dynres.scale + 0.5f), dynres.gpu_ms, dynres.target_ms);
+	if (scene_target) present(*scene_target);
 
 	// swap front and back buffers, and display to screen
+	PROFILE_SCOPE("swap");
 	glfwSwapBuffers(window);
 }
 
 void reshape(GLFWwindow* window, int width, int height)
 {
+	if (recorder) recorder.resize(width, height);
 	// set current viewport in pixels (win_x, win_y, win_width, win_height)
 	// viewport: the window area that are affected by rendering
 	window_size = ivec2(width, height);
@@ -211,31 +608,126 @@ void print_help()
 	printf("[help]\n");
 	printf("- press ESC or 'q' to terminate the program\n");
 	printf("- press F1 or 'h' to see help\n");
+	printf("- press F5 for frame pacing stats, F6 to cycle the swap interval, F7 to toggle low-latency mode\n");
 	printf("- press 'r' to stop rotate\n");
+	printf("- press '+'/'-' to double/halve the time scale, and 't' to toggle fixed/variable simulation steps\n");
 	printf("- press 'n' to see normal mapping\n");
+	printf("- press 'u' to re-stream planet textures in background\n");
+	printf("- press 'b' to toggle batched (instanced) drawing\n");
+	printf("- press 'c' to toggle view-frustum culling\n");
+	printf("- press 'a' to toggle the asteroid belt\n");
+	printf("- press 's' to toggle the stars, and '['/']' to lower/raise their limit magnitude\n");
+	printf("- press 'd' to toggle dynamic resolution (target %.1f ms per frame)\n", dynres.target_ms);
+	printf("- press 'v' to toggle shader permutations (per-object drawing)\n");
+	printf("- press 'p' to toggle the frame profiler (summary on stdout)\n");
+	printf("- press F4 to export profiled frames as a Chrome trace (profile.json)\n");
+	printf("- press F2 to print uniform calls of the last frame\n");
+	printf("- press F3 to print CPU submit time of both drawing paths, culling, simulation, resolution and render queue stats\n");
 #ifndef GL_ES_VERSION_2_0
 	printf("- press 'w' to toggle wireframe\n");
 #endif
 	printf("\n");
 }
 
+void apply_input(bool frame = true);
+
 void keyboard(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
+	if (recorder) recorder.key(key, scancode, action, mods);
+	apply_input(false);
 	if (action == GLFW_PRESS)
 	{
 		if (key == GLFW_KEY_ESCAPE || key == GLFW_KEY_Q)	glfwSetWindowShouldClose(window, GL_TRUE);
 		else if (key == GLFW_KEY_H || key == GLFW_KEY_F1)	print_help();
+		else if (pacer.keyboard(key))						{}
 		else if (key == GLFW_KEY_HOME)					cam = camera();
 		else if (key == GLFW_KEY_R)
 		{
-			b_rotate = !b_rotate;
-			printf("> %s\n", b_rotate ? "rotate" : "stop");
+			sim.paused = !sim.paused;
+			printf("> %s\n", sim.paused ? "stop" : "rotate");
+		}
+		else if (key == GLFW_KEY_EQUAL || key == GLFW_KEY_KP_ADD || key == GLFW_KEY_MINUS || key == GLFW_KEY_KP_SUBTRACT)
+		{
+			bool faster = key == GLFW_KEY_EQUAL || key == GLFW_KEY_KP_ADD;
+			sim.scale = std::min(64.0, std::max(1.0 / 64.0, sim.scale * (faster ? 2.0 : 0.5)));
+			printf("> time scale x%g\n", sim.scale.load());
+		}
+		else if (key == GLFW_KEY_T)
+		{
+			sim.fixed_step = sim.fixed_step > 0 ? 0.0 : sim_step;
+			printf("> %s simulation step\n", sim.fixed_step > 0 ? "fixed" : "variable");
 		}
 		else if (key == GLFW_KEY_N)
 		{
 			b_normal = !b_normal;
 			printf("> %s\n", b_normal ? "normal mapping" : "texture");
 		}
+		else if (key == GLFW_KEY_F2)	printf("> uniform calls in the last frame: %d issued, %d skipped, %d block updates\n", uniform_stats_last().calls, uniform_stats_last().skipped, uniform_stats_last().blocks);
+		else if (key == GLFW_KEY_F3)
+		{
+			printf("> submit: per-object %.3f ms, batched %.3f ms (%d draws)\n", submit_time[0] * 1000.0, submit_time[1] * 1000.0, batch.draws);
+			printf("> culling: %d of %d systems, %d of %d bodies visible\n", int(systems.count) - systems.culled, int(systems.count), int(bodies.count) - bodies.culled, int(bodies.count));
+			printf("> simulation: %.3f ms per step at %.0f Hz, %d of %d world matrices recomputed\n", snap_curr.cost * 1000.0, 1.0 / sim_step, snap_curr.recomputed, int(snap_curr.world.size()));
+			printf("> simulation clock %.2f s, time scale x%g, %s step%s\n", snap_curr.clock, sim.scale.load(), sim.fixed_step > 0 ? "fixed" : "variable", sim.paused ? ", paused" : "");
+			printf("> resolution scale %.2f, scene %.2f ms (target %.1f ms)\n", b_dynres ? dynres.scale : 1.0f, dynres.gpu_ms, dynres.target_ms);
+			inputs.print_stats();
+			belt.print_stats();
+			sky.print_stats();
+			printf("> render queue: %d draws, %d state changes (%d programs, %d vertex arrays, %d textures, %d blends)\n", queue.stats.draws, queue.stats.state_changes(), queue.stats.programs, queue.stats.vertex_arrays, queue.stats.textures, queue.stats.blends);
+		}
+		else if (key == GLFW_KEY_D)
+		{
+			b_dynres = !b_dynres;
+			dynres.reset();
+			if (scene_target) scene_target->set_scale(1.0f);
+			if (!b_dynres && scene_target == &dynres_target) { scene_target = nullptr; dynres_target.release(); }
+			printf("> dynamic resolution %s\n", b_dynres ? "on" : "off");
+		}
+		else if (key == GLFW_KEY_V)
+		{
+			b_variants = !b_variants;
+			printf("> per-object drawing with %s\n", b_variants ? "shader permutations" : "texphong");
+		}
+		else if (key == GLFW_KEY_P)
+		{
+			profiler().set_enabled(!profiler().enabled);
+			printf("> profiler %s\n", profiler().enabled ? "on" : "off");
+		}
+		else if (key == GLFW_KEY_F4)
+		{
+			if (profiler().export_trace("profile.json")) printf("> profiled frames exported to profile.json\n");
+		}
+		else if (key == GLFW_KEY_C)
+		{
+			b_cull = !b_cull;
+			printf("> frustum culling %s\n", b_cull ? "on" : "off");
+		}
+		else if (key == GLFW_KEY_A)
+		{
+			belt.enabled = !belt.enabled;
+			printf("> asteroid belt %s\n", belt.enabled ? "on" : "off");
+		}
+		else if (key == GLFW_KEY_S)
+		{
+			sky.enabled = !sky.enabled;
+			printf("> stars %s\n", sky.enabled ? "on" : "off");
+		}
+		else if (key == GLFW_KEY_LEFT_BRACKET || key == GLFW_KEY_RIGHT_BRACKET)
+		{
+			sky.limit += key == GLFW_KEY_RIGHT_BRACKET ? 0.5f : -0.5f;
+			printf("> stars to magnitude %.1f\n", sky.limit);
+		}
+		else if (key == GLFW_KEY_B)
+		{
+			b_batch = !b_batch;
+			printf("> %s drawing\n", b_batch ? "batched" : "per-object");
+		}
+		else if (key == GLFW_KEY_U)
+		{
+			for (int i = 0; i < 9; i++) uploader.request(mesh_texture_path[i], &PLANETTEX[i], true);
+			if (!batch_reload.valid()) batch_reload = std::async(std::launch::async, load_batch_images);
+			printf("> re-streaming planet textures\n");
+		}
 #ifndef GL_ES_VERSION_2_0
 		else if (key == GLFW_KEY_W)
 		{
@@ -253,10 +745,10 @@ void keyboard(GLFWwindow* window, int key, int scancode, int action, int mods)
 	}
 }
 
-void mouse(GLFWwindow* window, int button, int action, int mods)
+// a button event at a cursor position; replays pass the recorded position
+void mouse_at(int button, int action, dvec2 pos)
 {
 	if (button == GLFW_MOUSE_BUTTON_LEFT || GLFW_MOUSE_BUTTON_RIGHT || GLFW_MOUSE_BUTTON_MIDDLE) {
-		dvec2 pos; glfwGetCursorPos(window, &pos.x, &pos.y);
 		vec2 npos = cursor_to_ndc(pos, window_size);
 		if (action == GLFW_PRESS)			tb.begin(cam.view_matrix, npos);
 		else if (action == GLFW_RELEASE)	tb.end(cam.eye, cam.at);
@@ -264,16 +756,34 @@ void mouse(GLFWwindow* window, int button, int action, int mods)
 	}
 }
 
-void motion(GLFWwindow* window, double x, double y)
+bool track(dvec2 pos)
 {
-	if (!tb.is_tracking()) return;
-	vec2 npos = cursor_to_ndc(dvec2(x, y), window_size);
+	if (!tb.is_tracking()) return false;
+	vec2 npos = cursor_to_ndc(pos, window_size);
 
 	if (mousebtn == GLFW_MOUSE_BUTTON_LEFT && !shift && !ctrl) cam.view_matrix = tb.update(npos);
 	else if (mousebtn == GLFW_MOUSE_BUTTON_RIGHT || (mousebtn == GLFW_MOUSE_BUTTON_LEFT && shift))
 		cam.view_matrix = tb.zooming(npos, cam.eye, cam.at, cam.up);
 	else if (mousebtn == GLFW_MOUSE_BUTTON_MIDDLE || (mousebtn == GLFW_MOUSE_BUTTON_LEFT && ctrl))
 		cam.view_matrix = tb.panning(npos, cam.eye, cam.at, cam.up);
+	return true;
+}
+
+void apply_input(bool frame)
+{
+	inputs.apply([](const input_queue::event& e) { mouse_at(e.button, e.action, e.pos); }, track, frame);
+}
+
+void mouse(GLFWwindow* window, int button, int action, int mods)
+{
+	dvec2 pos; glfwGetCursorPos(window, &pos.x, &pos.y);
+	if (recorder) recorder.button(button, action, mods, pos.x, pos.y);
+	inputs.button(button, action, mods, pos);
+}
+void motion(GLFWwindow* window, double x, double y)
+{
+	if (recorder) recorder.cursor(x, y);
+	inputs.cursor(dvec2(x, y));
 }
 
 void update_vertex_buffer(uint H, uint V) {
@@ -281,6 +791,7 @@ void update_vertex_buffer(uint H, uint V) {
 	int b = 0;
 
 	sphere_t s;
+	sphere_bound = s.rotat_radius;
 	vertex corners[2701];
 	for (uint i = 0; i <= H; i++) {
 		for (uint j = 0; j <= V; j++) {
@@ -309,7 +820,7 @@ void update_vertex_buffer(uint H, uint V) {
 	}
 
 	// generation of vertex buffer is the same, but use vertices instead of corners
-	GLuint vertex_buffer;
+	if (vertex_buffer) glDeleteBuffers(1, &vertex_buffer);
 	glGenBuffers(1, &vertex_buffer);
 	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
@@ -321,10 +832,10 @@ void update_vertex_buffer(uint H, uint V) {
 
 	// load the Planet image to a texture
 	for (int i = 0; i < 9; i++) {
-		PLANETTEX[i] = cg_create_texture(mesh_texture_path[i], true); if (!PLANETTEX[i]) return ;
+		if (!uploader.load(mesh_texture_path[i], &PLANETTEX[i], true)) return ;
 	}
 	for (int i = 0; i < 9; i++) {
-		PLANETNORMTEX[i] = cg_create_texture(mesh_normal_texture_path[i], true); if (!PLANETNORMTEX[i]) return;
+		if (mesh_normal_texture_path[i] && !uploader.load(mesh_normal_texture_path[i], &PLANETNORMTEX[i], true)) return;
 	}
 }
 
@@ -333,6 +844,7 @@ void update_torus_vertex_buffer(uint H, uint V) {
 	int b = 0;
 
 	torus_t t;
+	torus_bound = sqrtf((t.Radius + t.radius) * (t.Radius + t.radius) + t.height * t.radius * t.height * t.radius);
 	vertex torus[2701];
 	for (uint i = 0; i <= H; i++) {
 		for (uint j = 0; j <= V; j++) {
@@ -361,7 +873,7 @@ void update_torus_vertex_buffer(uint H, uint V) {
 		}
 	}
 
-	GLuint torus_vertex_buffer;
+	if (torus_vertex_buffer) glDeleteBuffers(1, &torus_vertex_buffer);
 	glGenBuffers(1, &torus_vertex_buffer);
 	glBindBuffer(GL_ARRAY_BUFFER, torus_vertex_buffer);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(torus_vertices), torus_vertices, GL_STATIC_DRAW);
@@ -370,13 +882,56 @@ void update_torus_vertex_buffer(uint H, uint V) {
 	torus_vertex_array = cg_create_vertex_array(torus_vertex_buffer);
 	if (!torus_vertex_array) { printf("%s(): failed to create vertex aray\n", __func__); return ; }
 
+	// pack each ring color with its alpha map into one RGBA texture; the alpha images are released here
 	for (int i = 0; i < 2; i++) {
-		RINGTEX[i] = cg_create_texture(mesh_ring_texture_path[i], true); if (!RINGTEX[i]) return ;
+		image* color = load_image(mesh_ring_texture_path[i], max_texture_dim); if (!color) return;
+		image* alpha = load_image(mesh_ring_alpha_texture_path[i], max_texture_dim); if (!alpha) { delete color; return; }
+		image* packed = pack_rgba(color, alpha);
+		delete color; delete alpha;
+		if (!uploader.load(packed, mesh_ring_texture_path[i], &RINGTEX[i], true)) return;
 	}
+}
 
+// texture arrays of the batched renderer: layers must share one size, so the maps are resampled;
+// the images are decoded apart from the upload, so that 'u' can re-stream them off the render thread
+batch_images_t load_batch_images()
+{
+	int w = std::min(max_texture_dim, 2048), h = w / 2;
+	auto fit = [](image* i, int w, int h, int c) { image* r = resize_image(i, w, h, c); delete i; return r; };
+	batch_images_t b;
+	for (int i = 0; i < 9; i++) b.colors.push_back(fit(load_image(mesh_texture_path[i], max_texture_dim), w, h, 3));
+	for (int i = 0; i < 4; i++) b.colors.push_back(fit(load_image(mesh_satellite_texture_path[i], max_texture_dim), w, h, 3));
+	auto flat = [](int w, int h) { image* i = new image; i->width = w; i->height = h; i->channels = 3; i->ptr = (unsigned char*) malloc(size_t(w) * h * 3); if (!i->ptr) { delete i; return (image*) nullptr; } for (size_t k = 0; k < size_t(w) * h; k++) { i->ptr[k * 3] = i->ptr[k * 3 + 1] = 128; i->ptr[k * 3 + 2] = 255; } return i; };
+	for (int i = 0; i < 9; i++) b.normals.push_back(mesh_normal_texture_path[i] ? fit(load_image(mesh_normal_texture_path[i], max_texture_dim), w, h, 3) : flat(w, h));	// flat layers are never sampled
 	for (int i = 0; i < 2; i++) {
-		RINGALPHATEX[i] = cg_create_texture(mesh_ring_alpha_texture_path[i], true); if (!RINGALPHATEX[i]) return;
+		image* color = load_image(mesh_ring_texture_path[i], max_texture_dim);
+		image* alpha = load_image(mesh_ring_alpha_texture_path[i], max_texture_dim);
+		b.rings.push_back(pack_rgba(color, alpha)); delete color; delete alpha;
+		if (i && b.rings[0] && b.rings[i]) b.rings[i] = fit(b.rings[i], b.rings[0]->width, b.rings[0]->height, 4);
+	}
+	return b;
+}
+
+// upload the images into new arrays, which replace the current ones only when all three are created
+bool create_batch_textures(batch_images_t b)
+{
+	auto complete = [](const std::vector<image*>& v) { return std::find(v.begin(), v.end(), nullptr) == v.end(); };
+	GLuint arrays[3] = { 0, 0, 0 };
+	bool ok = complete(b.colors) && complete(b.normals) && complete(b.rings);
+	if (ok) {
+		arrays[0] = create_texture_array(b.colors, true);
+		arrays[1] = create_texture_array(b.normals, true);
+		arrays[2] = create_texture_array(b.rings, true);
+		ok = arrays[0] && arrays[1] && arrays[2];
 	}
+	for (auto* i : b.colors) delete i;
+	for (auto* i : b.normals) delete i;
+	for (auto* i : b.rings) delete i;
+	if (!ok) { printf("%s(): failed to load the batched textures\n", __func__); delete_textures(3, arrays); return false; }
+	GLuint old[3] = { batch.color_array, batch.normal_array, batch.ring_array };
+	delete_textures(3, old);
+	batch.color_array = arrays[0]; batch.normal_array = arrays[1]; batch.ring_array = arrays[2];
+	return true;
 }
 
 bool user_init()
@@ -395,27 +950,348 @@ bool user_init()
 	glActiveTexture(GL_TEXTURE0);		// notify GL the current texture slot is 0
 	glActiveTexture(GL_TEXTURE1);
 	
+	// textures are decoded no larger than the window, and never past the 2048-texel layers of the batched arrays
+	max_texture_dim = std::min(2048, std::max(window_size.x, window_size.y));
+
+	// textures are staged through pixel unpack buffers; flushed once before the first frame
+	if (!uploader.init()) return false;
+	uploader.max_dim = max_texture_dim;
 	update_vertex_buffer(2 * NUM_TESS, NUM_TESS);
 	update_torus_vertex_buffer(2 * NUM_TESS, NUM_TESS);
 	for (int i = 0; i < 4; i++) {
-		SATELLITE[i] = cg_create_texture(mesh_satellite_texture_path[i], true); if (!SATELLITE[i]) return false;
+		if (!uploader.load(mesh_satellite_texture_path[i], &SATELLITE[i], true)) return false;
+	}
+	uploader.flush();
+	print_image_load_report();
+
+	// permutations attach to the shared blocks when built; the common ones are built up front
+	variants.on_link = [](GLuint p) { camera_ubo.attach(p); light_ubo.attach(p); material_ubo.attach(p); };
+	for (uint32_t m : { 0u, uint32_t(VARIANT_UNLIT), uint32_t(VARIANT_NORMAL_MAP), uint32_t(VARIANT_ALPHA_MAP) }) variants.get(m);
+	printf("> %d shader permutations built in %.1f ms\n", int(variants.cache.size()), variants.compile_time * 1000.0);
+
+	// batched drawing shares the vertex buffers, and samples texture arrays of the same maps
+	if (!batch.init(vertex_buffer, 15552, torus_vertex_buffer, 15984)) return false;
+	camera_ubo.attach(batch.program); light_ubo.attach(batch.program); material_ubo.attach(batch.program);
+	if (!create_batch_textures(load_batch_images())) return false;
+
+	// the star catalogue is read from a file when given, and generated (then saved there) otherwise
+	if (star_path || star_count) {
+		if (!star_path || !sky.load(star_path)) {
+			sky.generate(star_count);
+			if (star_path && sky.save(star_path)) printf("> star catalogue saved to %s\n", star_path);
+		}
+		if (sky.init()) camera_ubo.attach(sky.program);
+		else sky.release();
 	}
+
+	// the first step runs here, so the first frame has a snapshot; the thread takes over from then
+	build_scene();
+	simulate();
+	consume_snapshot();
+
+	// the belt spans 2.1-3.3 AU between the orbits of Mars (1.52 AU) and Jupiter (5.2 AU), mapped onto the scene's
+	if (belt_count > 0 && planet_node.size() > 5) {
+		float mars = matrix_origin(frame_world[planet_node[4]]).length(), jupiter = matrix_origin(frame_world[planet_node[5]]).length();
+		belt_params bp;
+		bp.count = belt_count;
+		bp.scale = (jupiter - mars) / (5.2 - 1.52);
+		bp.offset = mars - 1.52 * bp.scale;
+		bp.min_size = float(0.003 * bp.scale); bp.max_size = float(0.03 * bp.scale);
+		double t0 = glfwGetTime();
+		if (belt.init(bp)) { camera_ubo.attach(belt.program); light_ubo.attach(belt.program); printf("> asteroid belt: %d asteroids in %.1f ms\n", belt.params.count, (glfwGetTime() - t0) * 1000.0); }
+		else belt.release();
+	}
+	if (b_lockstep) return true;	// lockstep frames step the simulation themselves
+	sim_running = true;
+	sim_thread = std::thread(simulation_loop);
 	return true;
 }
 
+// compare the mutable per-level texture path against immutable storage over all A4 assets
+void bench_textures(int repeat = 5)
+{
+	std::vector<const char*> paths;
+	auto add = [&](const char* const* p, int n) { for (int i = 0; i < n; i++) if (p[i] && std::find_if(paths.begin(), paths.end(), [&](const char* q) { return strcmp(q, p[i]) == 0; }) == paths.end()) paths.push_back(p[i]); };
+	add(mesh_texture_path, 9); add(mesh_normal_texture_path, 9); add(mesh_ring_texture_path, 2); add(mesh_ring_alpha_texture_path, 2); add(mesh_satellite_texture_path, 4);
+
+	printf("[texture benchmark] %d assets, best of %d runs\n", int(paths.size()), repeat);
+	printf("%-44s %10s %10s\n", "asset", "mutable", "immutable");
+	double total[2] = { 0, 0 };
+	for (auto path : paths)
+	{
+		image* i = cg_load_image(path); if (!i) continue;	// decoding is excluded from timing
+		double best[2] = { 1e9, 1e9 };
+		for (int r = 0; r < repeat; r++)
+		{
+			for (int m = 0; m < 2; m++)
+			{
+				glFinish();
+				double t0 = glfwGetTime();
+				GLuint tex = m == 0 ? create_texture_mutable(i, true) : create_texture(i, true);
+				glFinish();
+				best[m] = std::min(best[m], glfwGetTime() - t0);
+				delete_textures(1, &tex);
+			}
+		}
+		printf("%-44s %8.2fms %8.2fms\n", path, best[0] * 1000.0, best[1] * 1000.0);
+		total[0] += best[0]; total[1] += best[1];
+		delete i;
+	}
+	printf("%-44s %8.2fms %8.2fms\n", "total", total[0] * 1000.0, total[1] * 1000.0);
+	if (!glTexStorage2D) printf("(glTexStorage2D unavailable: immutable path used the single-allocation fallback)\n");
+}
+
+// camera keyframes of headless runs: one "frame eye.x eye.y eye.z at.x at.y at.z" per line, in frame order;
+// the camera is interpolated linearly between keyframes, and holds the first/last one outside them
+struct camera_key { float frame; vec3 eye, at; };
+
+bool load_camera_path(const char* path, std::vector<camera_key>& keys)
+{
+	FILE* fp = fopen(path, "r"); if (!fp) { printf("%s(): unable to open %s\n", __func__, path); return false; }
+	char line[256];
+	for (int n = 1; fgets(line, sizeof(line), fp); n++) {
+		camera_key k;
+		if (line[0] == '#' || sscanf(line, "%f", &k.frame) < 1) continue;	// comments and blank lines
+		if (sscanf(line, "%f %f %f %f %f %f %f", &k.frame, &k.eye.x, &k.eye.y, &k.eye.z, &k.at.x, &k.at.y, &k.at.z) != 7 || (!keys.empty() && k.frame < keys.back().frame)) {
+			printf("%s(): %s:%d: expected \"frame eye.x eye.y eye.z at.x at.y at.z\" after the previous frame\n", __func__, path, n);
+			fclose(fp); return false;
+		}
+		keys.push_back(k);
+	}
+	fclose(fp);
+	if (keys.empty()) printf("%s(): %s has no keyframes\n", __func__, path);
+	return !keys.empty();
+}
+
+void camera_at_frame(const std::vector<camera_key>& keys, float f, vec3& eye, vec3& at)
+{
+	size_t k = 0; while (k + 1 < keys.size() && keys[k + 1].frame <= f) k++;
+	const camera_key& a = keys[k]; const camera_key& b = keys[std::min(k + 1, keys.size() - 1)];
+	float t = b.frame > a.frame ? std::min(std::max((f - a.frame) / (b.frame - a.frame), 0.0f), 1.0f) : 0.0f;
+	eye = a.eye + (b.eye - a.eye) * t;
+	at = a.at + (b.at - a.at) * t;
+}
+
+// render the given frames at window_size into dir/frame_NNNN.ppm (dir=nullptr: no files), along the
+// keyframes of a camera path, or on one orbit of the camera around the sun without them
+int run_headless(int frames, const char* dir, const std::vector<camera_key>& path)
+{
+	render_target target;
+	if (!target.create(window_size.x, window_size.y)) return 1;
+	std::vector<unsigned char> rgb;
+	vec3 eye0 = cam.eye;
+	float radius = sqrtf(eye0.x * eye0.x + eye0.y * eye0.y);
+	double render_total = 0, t_start = glfwGetTime();
+	printf("[headless] %d frames at %dx%d%s%s%s\n", frames, window_size.x, window_size.y, dir ? " to " : "", dir ? dir : "", path.empty() ? "" : " along a camera path");
+	for (frame = 0; frame < frames; frame++)
+	{
+		fixed_time = frame * frame_step;
+		if (!path.empty()) camera_at_frame(path, float(frame), cam.eye, cam.at);
+		else { float a = 2.0f * PI * frame / float(frames); cam.eye = vec3(radius * cos(a), radius * sin(a), eye0.z + radius * 0.2f); }
+		cam.view_matrix = mat4::look_at(cam.eye, cam.at, cam.up);
+		simulate();
+
+		double t0 = glfwGetTime();
+		target.bind();
+		update();
+		render();
+		glFinish();
+		render_total += glfwGetTime() - t0;
+		uniform_frame_end();
+		profiler().frame_end();
+
+		if (!dir) continue;
+		char path[1024]; snprintf(path, sizeof(path), "%s/frame_%04d.ppm", dir, frame);
+		target.read(rgb);
+		if (!write_ppm(path, target.width, target.height, rgb)) { target.release(); return 1; }
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	target.release();
+	printf("[headless] render %.3f ms/frame, total %.2f s\n", render_total * 1000.0 / std::max(frames, 1), glfwGetTime() - t_start);
+	return 0;
+}
+
+// feed a recording back frame by frame on its own clock; per-frame times (and checksums of the
+// offscreen frame) go to <path>.csv, so that two builds can be compared on the same workload
+int run_replay(const char* path, bool checksum)
+{
+	input_player player;
+	if (!player.load(path)) return 1;
+	window_size = ivec2(player.header.width, player.header.height);
+	render_target target;
+	if (!target.create(window_size.x, window_size.y)) return 1;
+	scene_target = &target;
+
+	std::string csv_path = std::string(path) + ".csv";
+	FILE* csv = fopen(csv_path.c_str(), "w");
+	if (csv) fprintf(csv, "frame,ms%s\n", checksum ? ",checksum" : "");
+	printf("[replay] %s: %d frames, %d events at %dx%d\n", path, player.frames(), int(player.events.size()), window_size.x, window_size.y);
+
+	std::vector<double> times;
+	std::vector<unsigned char> rgb;
+	for (frame = 0; frame < player.frames() && !glfwWindowShouldClose(window); frame++)
+	{
+		glfwPollEvents();	// keeps the window responsive; live input is not connected
+		player.dispatch(uint32_t(frame), [](const input_event& e) {
+			if (e.type == INPUT_KEY)			keyboard(window, e.i[0], e.i[1], e.i[2], e.i[3]);
+			else if (e.type == INPUT_BUTTON)	inputs.button(e.i[0], e.i[1], e.i[2], dvec2(e.x, e.y));
+			else if (e.type == INPUT_CURSOR)	motion(window, e.x, e.y);
+			else if (e.type == INPUT_RESIZE)	window_size = ivec2(e.i[0], e.i[1]);
+		});
+		apply_input();
+		if (target.width != window_size.x || target.height != window_size.y) target.create(window_size.x, window_size.y);
+
+		fixed_time = player.clocks[frame];
+		simulate();
+		double t0 = glfwGetTime();
+		update();
+		render();
+		glFinish();
+		times.push_back(glfwGetTime() - t0);
+		uniform_frame_end();
+		profiler().frame_end();
+
+		if (csv) fprintf(csv, "%d,%.3f", frame, times.back() * 1000.0);
+		if (checksum) { target.read(rgb); if (csv) fprintf(csv, ",%016llx", (unsigned long long) image_checksum(rgb)); }
+		if (csv) fprintf(csv, "\n");
+	}
+	if (csv) fclose(csv);
+	scene_target = nullptr;
+	target.release();
+
+	if (times.empty()) return 0;
+	double total = 0; for (double t : times) total += t;
+	std::sort(times.begin(), times.end());
+	printf("[replay] %d frames: mean %.3f ms, p50 %.3f ms, p99 %.3f ms; per-frame times in %s\n", int(times.size()), total * 1000.0 / times.size(), times[times.size() / 2] * 1000.0, times[std::min(times.size() - 1, times.size() * 99 / 100)] * 1000.0, csv_path.c_str());
+	return 0;
+}
+
+// build every program of A4 without the binary cache, then twice with it (filling it, then
+// reading it back); the sources are the same as at startup
+void bench_programs()
+{
+	auto build = [](bool cached) {
+		program_cache& c = program_binaries();
+		c.enabled = cached; c.hits = c.misses = 0; c.time = 0;
+		std::vector<GLuint> programs;
+		programs.push_back(c.create_from_files(vert_shader_path, frag_shader_path));
+		programs.push_back(c.create(batch_vert_source, batch_frag_source));
+		for (uint32_t m = 0; m < 8; m++) { std::string d = variants.defines(m); programs.push_back(c.create(inject_defines(variant_vert_source, d), inject_defines(variant_frag_source, d))); }
+		glFinish();
+		printf("%-24s %8.1f ms  (%d from cache, %d compiled)\n", !cached ? "without cache" : c.hits ? "with cache (warm)" : "with cache (cold)", c.time * 1000.0, c.hits, c.misses);
+		for (GLuint p : programs) if (p) glDeleteProgram(p);
+	};
+	printf("[program benchmark] %s\n", program_binaries().supported() ? "" : "(program binaries unsupported by this driver)");
+	build(false);
+	build(true);
+	build(true);
+	program_binaries().enabled = true;
+}
+
+// random belt-like orbits (eccentricities up to 0.9) solved by the scalar and SIMD lanes in
+// float and double; errors are the largest distance to the double SIMD positions
+void bench_ephemeris(int count, int repeat = 20)
+{
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	ephemeris<float> ef; ephemeris<double> ed;
+	for (int k = 0; k < count; k++) {
+		orbital_elements o;
+		o.a = 2.2 + uniform(rng) * 1.1; o.e = uniform(rng) * 0.9; o.i = uniform(rng) * 0.3;
+		o.node = uniform(rng) * 2 * PI; o.peri = uniform(rng) * 2 * PI; o.M0 = uniform(rng) * 2 * PI; o.n = pow(o.a, -1.5);
+		ef.add(o); ed.add(o);
+	}
+	std::vector<double> rx, ry, rz;
+	auto run = [&](auto& eph, bool simd, const char* name) {
+		double best = 1e9;
+		for (int r = 0; r < repeat; r++) { double t0 = glfwGetTime(); eph.evaluate(100.0 + r, simd); best = std::min(best, glfwGetTime() - t0); }
+		eph.evaluate(100.0, simd);
+		if (rx.empty()) { rx.assign(eph.x.begin(), eph.x.end()); ry.assign(eph.y.begin(), eph.y.end()); rz.assign(eph.z.begin(), eph.z.end()); }
+		double err = 0;
+		for (int k = 0; k < count; k++) err = std::max(err, sqrt(pow(eph.x[k] - rx[k], 2) + pow(eph.y[k] - ry[k], 2) + pow(eph.z[k] - rz[k], 2)));
+		printf("%-16s %10.0f bodies/ms  %7.3f ms  max %2d iterations  error %.2e\n", name, count / (best * 1000.0), best * 1000.0, eph.iterations, err);
+	};
+	printf("[ephemeris benchmark] %d bodies, best of %d\n", count, repeat);
+	run(ed, true, "double, SIMD");
+	run(ed, false, "double, scalar");
+	run(ef, true, "float, SIMD");
+	run(ef, false, "float, scalar");
+}
+
 void user_finalize()
 {
+	watcher.release();
+	pacer.release();
+	sim_running = false;
+	if (sim_thread.joinable()) sim_thread.join();
+	recorder.close();
+	if (batch_reload.valid()) { batch_images_t b = batch_reload.get(); for (auto* v : { &b.colors, &b.normals, &b.rings }) for (auto* i : *v) delete i; }
+	dynres_target.release();
+	variants.release();
+	dynres.release();
+	profiler().release();
+	uploader.release();
+	batch.release();
+	belt.release();
+	sky.release();
+	camera_ubo.release();
+	light_ubo.release();
+	material_ubo.release();
 }
 
 int main(int argc, char* argv[])
 {
+	// --headless <frames> <width> <height> [dir] [--camera-path <file>]: render offscreen without a visible window
+	int headless_frames = 0; const char* headless_dir = nullptr; ivec2 headless_size;
+	std::vector<camera_key> camera_path;
+	if (argc > 4 && strcmp(argv[1], "--headless") == 0) {
+		b_headless = true;
+		headless_frames = atoi(argv[2]);
+		window_size = headless_size = ivec2(atoi(argv[3]), atoi(argv[4]));
+		if (argc > 5 && strncmp(argv[5], "--", 2) != 0) headless_dir = argv[5];
+		for (int i = 5; i + 1 < argc; i++) if (strcmp(argv[i], "--camera-path") == 0 && !load_camera_path(argv[i + 1], camera_path)) return 1;
+#if defined(GLFW_PLATFORM_NULL) && !defined(_WIN32) && !defined(__APPLE__)
+		// without a display, GLFW 3.4 runs windowless and creates an OSMesa context
+		if (!getenv("DISPLAY") && !getenv("WAYLAND_DISPLAY")) glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#endif
+	}
+	// --record <file>: log input with lockstep frames; --replay <file> [--checksum]: play it back
+	const char* record_path = argc > 2 && strcmp(argv[1], "--record") == 0 ? argv[2] : nullptr;
+	const char* replay_path = argc > 2 && strcmp(argv[1], "--replay") == 0 ? argv[2] : nullptr;
+	bool replay_checksum = argc > 3 && strcmp(argv[3], "--checksum") == 0;
+	b_lockstep = b_headless || record_path || replay_path;
+	for (int i = 1; i + 1 < argc; i++) if (strcmp(argv[i], "--target-ms") == 0) dynres.target_ms = float(atof(argv[i + 1]));	// dynamic resolution target
+	for (int i = 1; i + 1 < argc; i++) if (strcmp(argv[i], "--time-scale") == 0) sim.scale = atof(argv[i + 1]);				// simulation seconds per second
+	for (int i = 1; i < argc; i++) if (strcmp(argv[i], "--per-event-input") == 0) inputs.coalesce = false;
+	for (int i = 1; i < argc; i++) if (strcmp(argv[i], "--fixed-step") == 0) sim.fixed_step = sim_step;						// frame-rate independent steps
+	for (int i = 1; i + 1 < argc; i++) if (strcmp(argv[i], "--belt") == 0) belt_count = atoi(argv[i + 1]);					// asteroids in the belt
+	for (int i = 1; i + 1 < argc; i++) if (strcmp(argv[i], "--stars") == 0) star_count = uint32_t(atol(argv[i + 1]));		// stars of a generated catalogue
+	for (int i = 1; i + 1 < argc; i++) if (strcmp(argv[i], "--star-catalogue") == 0) star_path = argv[i + 1];				// binary star catalogue
+	for (int i = 1; i + 1 < argc; i++) if (strcmp(argv[i], "--star-limit") == 0) sky.limit = float(atof(argv[i + 1]));		// faintest magnitude drawn
+
 	// create window and initialize OpenGL extensions
-	if (!(window = cg_create_window(window_name, window_size.x, window_size.y))) { glfwTerminate(); return 1; }
+	if (!(window = cg_create_window(window_name, window_size.x, window_size.y, !b_headless))) { glfwTerminate(); return 1; }	// headless: never shown
+	if (b_headless) window_size = headless_size;	// the target keeps the requested size
 	if (!cg_init_extensions(window)) { glfwTerminate(); return 1; }	// init OpenGL extensions
+	if (argc > 1 && strcmp(argv[1], "--bench-ephemeris") == 0) { bench_ephemeris(argc > 2 ? atoi(argv[2]) : 100000); cg_destroy_window(window); return 0; }
+	if (argc > 1 && strcmp(argv[1], "--bench-textures") == 0) { bench_textures(); cg_destroy_window(window); return 0; }
 
 	// initializations and validations of GLSL program
-	if (!(program = cg_create_program(vert_shader_path, frag_shader_path))) { glfwTerminate(); return 1; }	// create and compile shaders/program
-	if (!user_init()) { printf("Failed to user_init()\n"); glfwTerminate(); return 1; }					// user initialization
+	double startup = glfwGetTime();
+	for (int i = 1; i < argc; i++) if (strcmp(argv[i], "--no-program-cache") == 0) program_binaries().enabled = false;
+	if (argc > 1 && strcmp(argv[1], "--bench-programs") == 0) { bench_programs(); cg_destroy_window(window); return 0; }
+	if (!(program = program_binaries().create_from_files(vert_shader_path, frag_shader_path))) { glfwTerminate(); return 1; }	// create and compile shaders/program
+	resolve_uniforms(program, u);
+	if (!camera_ubo.init() || !light_ubo.init() || !material_ubo.init()) { glfwTerminate(); return 1; }
+	if (!camera_ubo.attach(program) || !light_ubo.attach(program) || !material_ubo.attach(program)) printf("> %s: uniform blocks not declared; using plain uniforms\n", frag_shader_path);
+	watcher.add(vert_shader_path, frag_shader_path, &program, [](GLuint p) { resolve_uniforms(p, u); camera_ubo.attach(p); light_ubo.attach(p); material_ubo.attach(p); });
+	if (!user_init()) { printf("Failed to user_init()\n"); user_finalize(); glfwTerminate(); return 1; }					// user initialization
+	printf("> startup %.1f ms; programs %.1f ms (%d from the binary cache, %d compiled%s)\n", (glfwGetTime() - startup) * 1000.0, program_binaries().time * 1000.0, program_binaries().hits, program_binaries().misses, program_binaries().enabled ? "" : ", cache disabled");
+	if (b_headless) { int r = run_headless(headless_frames, headless_dir, camera_path); user_finalize(); cg_destroy_window(window); return r; }
+	if (replay_path) { int r = run_replay(replay_path, replay_checksum); user_finalize(); cg_destroy_window(window); return r; }
+	if (record_path && !recorder.open(record_path, window_size.x, window_size.y, frame_step)) { user_finalize(); glfwTerminate(); return 1; }
+
+	pacer.parse(argc, argv); pacer.init();
 
 	// register event callbacks
 	glfwSetWindowSizeCallback(window, reshape);	// callback for window resizing events
@@ -426,9 +1302,17 @@ int main(int argc, char* argv[])
 	// enters rendering/event loop
 	for (frame = 0; !glfwWindowShouldClose(window); frame++)
 	{
-		glfwPollEvents();	// polling and processing of events
-		update();			// per-frame update
+		{ PROFILE_SCOPE("reload"); watcher.poll(); }
+		{ PROFILE_SCOPE("pacing"); pacer.wait(); }
+		{ PROFILE_SCOPE("events"); glfwPollEvents(); pacer.input_sampled(); }	// polling and processing of events
+		{ PROFILE_SCOPE("input"); apply_input(); }
+		if (b_lockstep) { fixed_time = frame * frame_step; simulate(); }
+		{ PROFILE_SCOPE("update"); update(); }			// per-frame update
 		render();			// per-frame render
+		pacer.presented();
+		if (recorder) recorder.frame_end(fixed_time);
+		uniform_frame_end();
+		profiler().frame_end();
 	}
 
 	// normal termination
@@ -2,6 +2,11 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "cgut.h"		// slee's OpenGL utility
 #include "trackball.h"
+#include "texture.h"
+#include "uniform.h"
+#include "shader_watch.h"
+#include "pacing.h"
+#include "input_queue.h"
 
 //*************************************
 // global constants
@@ -11,6 +16,7 @@ static const char*	frag_shader_path	= "../bin/shaders/texture.frag";
 static const char*	image_path		= "../bin/images/earth.jpg";
 static const char*	normal_image_path = "../bin/images/earth-normal.jpg";
 static const char* bump_image_path = "../bin/images/earth-bump.jpg";
+static const float	bump_strength = 2.0f;	// slope scale of the normal map derived from the bump image
 
 //*************************************
 // common structures
@@ -44,6 +50,14 @@ struct material_t
 	float	shininess = 1000.0f;
 };
 
+struct uniforms
+{
+	uniform_t	mode = "mode", view_matrix = "view_matrix", projection_matrix = "projection_matrix", model_matrix = "model_matrix";
+	uniform_t	light_position = "light_position", Ia = "Ia", Id = "Id", Is = "Is";
+	uniform_t	Ka = "Ka", Kd = "Kd", Ks = "Ks", shininess = "shininess";
+	uniform_t	TEX0 = "TEX0", NORM = "NORM";
+};
+
 //*************************************
 // window objects
 GLFWwindow*	window = nullptr;
@@ -55,7 +69,7 @@ GLuint	program	= 0;		// ID holder for GPU program
 GLuint  vertex_array = 0;	// ID holder for vertex array object
 GLuint	LENA = 0;			// RGB texture object
 GLuint	NORM = 0;			// RGB texture object
-GLuint	BUMP = 0;			// RGB texture object
+GLuint	BUMP = 0;			// RGB normal map derived from the bump image
 
 //*************************************
 // global variables
@@ -64,6 +78,7 @@ uint	mode = 0;			// texture display mode: 0=texcoord, 1=RGB, 2=Gray, 3=Alpha
 int		mousebtn = -1;
 #ifndef GL_ES_VERSION_2_0
 bool	b_wireframe = false;
+bool	b_bump = false;		// use the normal map derived from the bump image
 bool	shift = false;
 bool	ctrl = false;
 #endif
@@ -72,14 +87,21 @@ bool	ctrl = false;
 // scene objects
 camera cam;
 trackball tb;
+input_queue inputs;
 light_t	light;
 material_t material;
+uniforms u;
+shader_watch watcher;
+frame_pacer pacer;
+uniform_block_t<camera_block>	camera_ubo("Camera", CAMERA_BLOCK);
+uniform_block_t<light_block>	light_ubo("Light", LIGHT_BLOCK);
+uniform_block_t<material_block>	material_ubo("Material", MATERIAL_BLOCK);
 
 //*************************************
 void update()
 {
 	glUseProgram( program );
-	glUniform1i( glGetUniformLocation( program, "mode"), mode );
+	u.mode.set( int(mode) );
 	// update projection matrix
 	cam.aspect = window_size.x / float(window_size.y);
 	cam.projection_matrix = mat4::perspective(cam.fovy, cam.aspect, cam.dnear, cam.dfar);
@@ -99,21 +121,28 @@ void update()
 	mat4 model_matrix = rotation_matrix;
 
 	// update uniform variables in vertex/fragment shaders
-	GLint uloc;
-	uloc = glGetUniformLocation(program, "view_matrix");			if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, cam.view_matrix);
-	uloc = glGetUniformLocation(program, "projection_matrix");		if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, cam.projection_matrix);
-	uloc = glGetUniformLocation(program, "model_matrix");			if (uloc > -1) glUniformMatrix4fv(uloc, 1, GL_TRUE, model_matrix);
-
-	glUniform4fv(glGetUniformLocation(program, "light_position"), 1, light.position);
-	glUniform4fv(glGetUniformLocation(program, "Ia"), 1, light.ambient);
-	glUniform4fv(glGetUniformLocation(program, "Id"), 1, light.diffuse);
-	glUniform4fv(glGetUniformLocation(program, "Is"), 1, light.specular);
+	// uniform blocks are uploaded only when their contents changed; plain uniforms of block members are no-ops
+	camera_ubo.set({ cam.view_matrix, cam.projection_matrix });
+	light_ubo.set({ light.position, light.ambient, light.diffuse, light.specular });
+	material_ubo.set({ material.ambient, material.diffuse, material.specular, material.shininess });
+	camera_ubo.update();
+	light_ubo.update();
+	material_ubo.update();
+
+	u.view_matrix.set(cam.view_matrix);
+	u.projection_matrix.set(cam.projection_matrix);
+	u.model_matrix.set(model_matrix);
+
+	u.light_position.set(light.position);
+	u.Ia.set(light.ambient);
+	u.Id.set(light.diffuse);
+	u.Is.set(light.specular);
 
 	// setup material properties
-	glUniform4fv(glGetUniformLocation(program, "Ka"), 1, material.ambient);
-	glUniform4fv(glGetUniformLocation(program, "Kd"), 1, material.diffuse);
-	glUniform4fv(glGetUniformLocation(program, "Ks"), 1, material.specular);
-	glUniform1f(glGetUniformLocation(program, "shininess"), material.shininess);
+	u.Ka.set(material.ambient);
+	u.Kd.set(material.diffuse);
+	u.Ks.set(material.specular);
+	u.shininess.set(material.shininess);
 }
 
 void render()
@@ -125,13 +154,11 @@ void render()
 	glUseProgram( program );
 	//glBindVertexArray(vertex_array);
 	// bind textures
-	glActiveTexture( GL_TEXTURE0 );
-	glBindTexture( GL_TEXTURE_2D, LENA );
-	glUniform1i( glGetUniformLocation( program, "TEX0"), 0 );
+	bind_texture( 0, GL_TEXTURE_2D, LENA );	// with the sampler matching its mip chain
+	u.TEX0.set( 0 );
 
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, NORM);
-	glUniform1i(glGetUniformLocation(program, "NORM"), 1);
+	bind_texture(1, GL_TEXTURE_2D, b_bump ? BUMP : NORM);
+	u.NORM.set(1);
 
 	// bind vertex array object
 	glBindVertexArray( vertex_array );
@@ -156,21 +183,36 @@ void print_help()
 	printf( "[help]\n" );
 	printf( "- press ESC or 'q' to terminate the program\n" );
 	printf( "- press F1 or 'h' to see help\n" );
+	printf( "- press F3 to print input callbacks and trackball evaluations per frame\n" );
+	printf( "- press F5 for frame pacing stats, F6 to cycle the swap interval, F7 to toggle low-latency mode\n" );
+	printf( "- press F2 to print uniform calls of the last frame\n" );
 	printf( "- press 'd' to toggle display mode (0: texcoord, 1: RGB, 2: Gray, 3: Alpha\n" );
+	printf( "- press 'b' to toggle normal map between earth-normal and the one derived from earth-bump\n" );
 	printf( "\n" );
 }
 
+void apply_input( bool frame=true );
+
 void keyboard( GLFWwindow* window, int key, int scancode, int action, int mods )
 {
+	apply_input( false );
 	if(action==GLFW_PRESS)
 	{
 		if(key==GLFW_KEY_ESCAPE||key==GLFW_KEY_Q)	glfwSetWindowShouldClose( window, GL_TRUE );
 		else if(key==GLFW_KEY_H||key==GLFW_KEY_F1)	print_help();
+		else if(pacer.keyboard(key))				{}
+		else if(key==GLFW_KEY_F3)	inputs.print_stats();
+		else if(key==GLFW_KEY_F2)	printf( "> uniform calls in the last frame: %d issued, %d skipped, %d block updates\n", uniform_stats_last().calls, uniform_stats_last().skipped, uniform_stats_last().blocks );
 		else if(key==GLFW_KEY_D)
 		{
 			mode = (mode+1)%4;
 			printf( "using mode %d: %s\n", mode, mode==0?"texcoord":mode==1?"RGB":mode==2?"Gray":"Alpha" );
 		}
+		else if(key==GLFW_KEY_B)
+		{
+			b_bump = !b_bump;
+			printf( "> normal map from %s\n", b_bump?"earth-bump":"earth-normal" );
+		}
 #ifndef GL_ES_VERSION_2_0
 		else if (key == GLFW_KEY_W)
 		{
@@ -182,10 +224,9 @@ void keyboard( GLFWwindow* window, int key, int scancode, int action, int mods )
 	}
 }
 
-void mouse(GLFWwindow* window, int button, int action, int mods)
+void mouse_at(int button, int action, dvec2 pos)
 {
 	if (button == GLFW_MOUSE_BUTTON_LEFT || GLFW_MOUSE_BUTTON_RIGHT || GLFW_MOUSE_BUTTON_MIDDLE) {
-		dvec2 pos; glfwGetCursorPos(window, &pos.x, &pos.y);
 		printf("%f %f\n", pos.x, pos.y);
 		vec2 npos = cursor_to_ndc(pos, window_size);
 		if (action == GLFW_PRESS)			tb.begin(cam.view_matrix, npos);
@@ -194,51 +235,48 @@ void mouse(GLFWwindow* window, int button, int action, int mods)
 	}
 }
 
-void motion(GLFWwindow* window, double x, double y)
+bool track(dvec2 pos)
 {
-	if (!tb.is_tracking()) return;
-	vec2 npos = cursor_to_ndc(dvec2(x, y), window_size);
+	if (!tb.is_tracking()) return false;
+	vec2 npos = cursor_to_ndc(pos, window_size);
 
 	if (mousebtn == GLFW_MOUSE_BUTTON_LEFT && !shift && !ctrl) cam.view_matrix = tb.update(npos);
 	else if (mousebtn == GLFW_MOUSE_BUTTON_RIGHT || (mousebtn == GLFW_MOUSE_BUTTON_LEFT && shift))
 		cam.view_matrix = tb.zooming(npos, cam.eye, cam.at, cam.up);
 	else if (mousebtn == GLFW_MOUSE_BUTTON_MIDDLE || (mousebtn == GLFW_MOUSE_BUTTON_LEFT && ctrl))
 		cam.view_matrix = tb.panning(npos, cam.eye, cam.at, cam.up);
+	return true;
+}
+
+void apply_input(bool frame)
+{
+	inputs.apply([](const input_queue::event& e) { mouse_at(e.button, e.action, e.pos); }, track, frame);
+}
+
+void mouse(GLFWwindow* window, int button, int action, int mods)
+{
+	dvec2 pos; glfwGetCursorPos(window, &pos.x, &pos.y);
+	inputs.button(button, action, mods, pos);
+}
+
+void motion(GLFWwindow* window, double x, double y)
+{
+	inputs.cursor(dvec2(x, y));
 }
 
 // this function will be avaialble as cg_create_texture() in other samples
-GLuint create_texture( const char* image_path, bool mipmap=true, GLenum wrap=GL_CLAMP_TO_EDGE, GLenum filter=GL_LINEAR )
+GLuint create_texture( const char* image_path, bool mipmap=true )
 {
 	// load image
-	image*	i = cg_load_image( image_path ); if(!i) return 0; // return null texture; 0 is reserved as a null texture
-	int		w=i->width, h=i->height, c=i->channels;
-
-	// induce internal format and format from image
-	GLint	internal_format = c==1?GL_R8:c==2?GL_RG8:c==3?GL_RGB8:GL_RGBA8;
-	GLenum	format = c==1?GL_RED:c==2?GL_RG:c==3?GL_RGB:GL_RGBA;
-
-	// create a src texture (lena texture)
-	GLuint texture;
-	glGenTextures( 1, &texture ); if(texture==0){ printf("%s(): failed in glGenTextures()\n", __func__ ); return 0; }
-	glBindTexture( GL_TEXTURE_2D, texture );
-	glTexImage2D( GL_TEXTURE_2D, 0, internal_format, w, h, 0, format, GL_UNSIGNED_BYTE, i->ptr );
-	if(i){ delete i; i=nullptr; } // release image
-
-	// build mipmap
-	if( mipmap )
-	{
-		int mip_levels=0; for( int k=w>h?w:h; k; k>>=1 ) mip_levels++;
-		for( int l=1; l < mip_levels; l++ )
-			glTexImage2D( GL_TEXTURE_2D, l, internal_format, (w>>l)==0?1:(w>>l), (h>>l)==0?1:(h>>l), 0, format, GL_UNSIGNED_BYTE, nullptr );
-		if(glGenerateMipmap) glGenerateMipmap(GL_TEXTURE_2D);
-	}
+	// decode no larger than twice the window, which is all the sphere can sample
+	int max_dim = 2*std::max(window_size.x,window_size.y);
+	image*	i = load_image( image_path, max_dim ); if(!i) return 0; // return null texture; 0 is reserved as a null texture
 
-	// set up texture parameters
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap );
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap );
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter );
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, !mipmap?filter:filter==GL_LINEAR?GL_LINEAR_MIPMAP_LINEAR:GL_NEAREST_MIPMAP_NEAREST );
+	// allocate immutable storage with its whole mip chain, and upload the image
+	GLuint texture = create_texture( i, mipmap );
+	if(i){ delete i; i=nullptr; } // release image
 
+	// texture parameters are not set here; they come from the shared sampler bound to each unit
 	return texture;
 }
 
@@ -301,7 +339,10 @@ bool user_init()
 	// load the Lena image to a texture
 	LENA = create_texture( image_path, true ); if(!LENA) return false;
 	NORM = create_texture(normal_image_path, true); if (!NORM) return false;
-	BUMP = create_texture(bump_image_path, true); if (!BUMP) return false;
+	image* bump_normal = load_normal_map(bump_image_path, bump_strength, 2 * std::max(window_size.x, window_size.y)); if (!bump_normal) return false;
+	BUMP = create_texture(bump_normal, true); delete bump_normal; if (!BUMP) return false;
+
+	print_image_load_report();
 
 	// set default display mode to lena
 	keyboard( window, GLFW_KEY_D, 0, GLFW_PRESS, 0 );
@@ -311,6 +352,11 @@ bool user_init()
 
 void user_finalize()
 {
+	watcher.release();
+	pacer.release();
+	camera_ubo.release();
+	light_ubo.release();
+	material_ubo.release();
 }
 
 int main( int argc, char* argv[] )
@@ -318,9 +364,15 @@ int main( int argc, char* argv[] )
 	// create window and initialize OpenGL extensions
 	if(!(window = cg_create_window( window_name, window_size.x, window_size.y ))){ glfwTerminate(); return 1; }
 	if(!cg_init_extensions( window )){ glfwTerminate(); return 1; }	// version and extensions
+	for( int i=1; i < argc; i++ ) if(strcmp(argv[i],"--per-event-input")==0) inputs.coalesce = false;
+	pacer.parse( argc, argv ); pacer.init();
 
 	// initializations and validations
 	if(!(program=cg_create_program( vert_shader_path, frag_shader_path ))){ glfwTerminate(); return 1; }	// create and compile shaders/program
+	resolve_uniforms( program, u );
+	if(!camera_ubo.init()||!light_ubo.init()||!material_ubo.init()){ glfwTerminate(); return 1; }
+	if(!camera_ubo.attach(program)||!light_ubo.attach(program)||!material_ubo.attach(program)) printf( "> %s: uniform blocks not declared; using plain uniforms\n", frag_shader_path );
+	watcher.add( vert_shader_path, frag_shader_path, &program, []( GLuint p ){ resolve_uniforms( p, u ); camera_ubo.attach(p); light_ubo.attach(p); material_ubo.attach(p); } );
 	if(!user_init()){ printf( "Failed to user_init()\n" ); glfwTerminate(); return 1; }					// user initialization
 
 	// register event callbacks
@@ -332,9 +384,15 @@ int main( int argc, char* argv[] )
 	// enters rendering/event loop
 	for( frame=0; !glfwWindowShouldClose(window); frame++ )
 	{
+		watcher.poll();
+		pacer.wait();
 		glfwPollEvents();	// polling and processing of events
+		pacer.input_sampled();
+		apply_input();
 		update();			// per-frame update
 		render();			// per-frame render
+		pacer.presented();
+		uniform_frame_end();
 	}
 	
 	// normal termination
@@ -0,0 +1,189 @@
+#pragma once
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "cgut.h"
+#include "uniform.h"
+#include "shader.h"
+#include "texture.h"
+
+//*************************************
+// per-instance data of the batched renderer
+struct instance_t
+{
+	mat4	model_matrix;			// row-major, as elsewhere
+	float	layer = 0;				// color layer in the texture array
+	float	normal_layer = -1;		// normal-map layer; negative: no normal mapping
+	float	unlit = 0;				// 1: emissive body (the sun)
+	float	alpha = 1;				// opacity, multiplied by the texture alpha
+};
+
+//*************************************
+// instanced Phong shading; reads the shared Camera/Light/Material blocks of uniform.h
+static const char* batch_vert_source = R"(
+#version 330
+layout(location=0) in vec3 position;
+layout(location=1) in vec3 normal;
+layout(location=2) in vec2 texcoord;
+layout(location=3) in vec4 model_row0;
+layout(location=4) in vec4 model_row1;
+layout(location=5) in vec4 model_row2;
+layout(location=6) in vec4 model_row3;
+layout(location=7) in vec4 params;	// layer, normal layer, unlit, alpha
+
+layout(std140, row_major) uniform Camera { mat4 view_matrix; mat4 projection_matrix; };
+
+out vec3 epos;
+out vec3 enorm;
+out vec3 etan;
+out vec2 tc;
+flat out vec4 p;
+
+void main()
+{
+	mat4 model_view = view_matrix*transpose(mat4(model_row0,model_row1,model_row2,model_row3));
+	vec4 ep = model_view*vec4(position,1);
+	epos = ep.xyz;
+	enorm = normalize(mat3(model_view)*normal);
+	etan = mat3(model_view)*vec3(-normal.y,normal.x,0.0001);	// along increasing longitude
+	tc = texcoord;
+	p = params;
+	gl_Position = projection_matrix*ep;
+}
+)";
+
+static const char* batch_frag_source = R"(
+#version 330
+in vec3 epos;
+in vec3 enorm;
+in vec3 etan;
+in vec2 tc;
+flat in vec4 p;
+out vec4 fragColor;
+
+layout(std140, row_major) uniform Camera { mat4 view_matrix; mat4 projection_matrix; };
+layout(std140) uniform Light { vec4 light_position, Ia, Id, Is; };
+layout(std140) uniform Material { vec4 Ka, Kd, Ks; float shininess; };
+uniform sampler2DArray TEX;
+uniform sampler2DArray NORM;
+
+void main()
+{
+	vec4 albedo = texture( TEX, vec3(tc,p.x) );
+	if(p.z>0.5){ fragColor = vec4(albedo.rgb,albedo.a*p.w); return; }
+
+	vec3 n = normalize(enorm);
+	if(p.y>=0.0)
+	{
+		vec3 t = normalize(etan-dot(etan,n)*n), b = cross(n,t);
+		n = normalize(mat3(t,b,n)*(texture( NORM, vec3(tc,p.y) ).xyz*2.0-1.0));
+	}
+	vec3 l = normalize((view_matrix*light_position).xyz-epos);
+	vec3 h = normalize(l+normalize(-epos));
+	vec4 Ira = Ka*Ia;
+	vec4 Ird = max(Kd*dot(l,n)*Id,0.0);
+	vec4 Irs = max(Ks*pow(max(dot(h,n),0.0),shininess)*Is,0.0);
+	fragColor = vec4((albedo*(Ira+Ird)+Irs).rgb,albedo.a*p.w);
+}
+)";
+
+//*************************************
+// batched renderer: every sphere instance is drawn with one instanced call, and
+// every ring with another; textures are layers of two texture arrays
+struct batch_renderer
+{
+	struct uniforms { uniform_t TEX = "TEX", NORM = "NORM"; };
+
+	GLuint		program = 0;
+	GLuint		sphere_vao = 0, ring_vao = 0;
+	GLuint		sphere_instances = 0, ring_instances = 0;
+	GLsizei		sphere_vertices = 0, ring_vertices = 0;
+	GLsizeiptr	sphere_capacity = 0, ring_capacity = 0;
+	GLuint		color_array = 0, normal_array = 0, ring_array = 0;
+	uniforms	u;
+
+	std::vector<instance_t>	spheres;
+	std::vector<instance_t>	rings;
+	int			draws = 0;		// draw calls of the last draw()
+
+	bool init( GLuint sphere_buffer, GLsizei sphere_count, GLuint ring_buffer, GLsizei ring_count )
+	{
+		if(!(program=program_binaries().create( batch_vert_source, batch_frag_source ))){ printf( "%s(): failed to create the batch program\n", __func__ ); return false; }
+		resolve_uniforms( program, u );
+		sphere_vertices = sphere_count; ring_vertices = ring_count;
+		if(!(sphere_vao=create_vertex_array( sphere_buffer, sphere_instances ))) return false;
+		if(!(ring_vao=create_vertex_array( ring_buffer, ring_instances ))) return false;
+		return true;
+	}
+
+	void begin(){ spheres.clear(); rings.clear(); }
+
+	void draw()
+	{
+		draws = 0;
+		glUseProgram( program );
+		u.TEX.set(0); u.NORM.set(1);
+		bind_texture( 1, GL_TEXTURE_2D_ARRAY, normal_array );
+		bind_texture( 0, GL_TEXTURE_2D_ARRAY, color_array );
+		if(!spheres.empty())
+		{
+			upload( sphere_instances, sphere_capacity, spheres );
+			glBindVertexArray( sphere_vao );
+			glDrawArraysInstanced( GL_TRIANGLES, 0, sphere_vertices, GLsizei(spheres.size()) ); draws++;
+		}
+		if(!rings.empty())
+		{
+			upload( ring_instances, ring_capacity, rings );
+			glEnable( GL_BLEND );
+			bind_texture( 0, GL_TEXTURE_2D_ARRAY, ring_array );
+			glBindVertexArray( ring_vao );
+			glDrawArraysInstanced( GL_TRIANGLES, 0, ring_vertices, GLsizei(rings.size()) ); draws++;
+			glDisable( GL_BLEND );
+		}
+		glBindTexture( GL_TEXTURE_2D_ARRAY, 0 );
+	}
+
+	void release()
+	{
+		if(program) glDeleteProgram( program );
+		program = 0;
+		GLuint vao[2]={sphere_vao,ring_vao}; glDeleteVertexArrays( 2, vao ); sphere_vao=ring_vao=0;
+		GLuint buf[2]={sphere_instances,ring_instances}; glDeleteBuffers( 2, buf ); sphere_instances=ring_instances=0;
+		GLuint tex[3]={color_array,normal_array,ring_array}; delete_textures( 3, tex ); color_array=normal_array=ring_array=0;
+	}
+
+protected:
+	// vertex attributes 0-2 from the mesh, and 3-7 from a per-instance buffer
+	GLuint create_vertex_array( GLuint vertex_buffer, GLuint& instance_buffer )
+	{
+		GLuint vao; glGenVertexArrays( 1, &vao ); if(!vao){ printf( "%s(): failed in glGenVertexArrays()\n", __func__ ); return 0; }
+		glGenBuffers( 1, &instance_buffer );
+		glBindVertexArray( vao );
+		glBindBuffer( GL_ARRAY_BUFFER, vertex_buffer );
+		glEnableVertexAttribArray(0); glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*) offsetof(vertex,pos) );
+		glEnableVertexAttribArray(1); glVertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*) offsetof(vertex,norm) );
+		glEnableVertexAttribArray(2); glVertexAttribPointer( 2, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*) offsetof(vertex,tex) );
+		glBindBuffer( GL_ARRAY_BUFFER, instance_buffer );
+		for( GLuint k=0; k < 5; k++ )
+		{
+			glEnableVertexAttribArray( 3+k );
+			glVertexAttribPointer( 3+k, 4, GL_FLOAT, GL_FALSE, sizeof(instance_t), (void*)(sizeof(vec4)*k) );
+			glVertexAttribDivisor( 3+k, 1 );
+		}
+		glBindVertexArray( 0 );
+		glBindBuffer( GL_ARRAY_BUFFER, 0 );
+		return vao;
+	}
+
+	void upload( GLuint buffer, GLsizeiptr& capacity, const std::vector<instance_t>& v )
+	{
+		GLsizeiptr size = GLsizeiptr(sizeof(instance_t)*v.size());
+		glBindBuffer( GL_ARRAY_BUFFER, buffer );
+		if(size>capacity) capacity = size*2;
+		glBufferData( GL_ARRAY_BUFFER, capacity, nullptr, GL_STREAM_DRAW );	// orphan the previous frame's data
+		glBufferSubData( GL_ARRAY_BUFFER, 0, size, v.data() );
+		glBindBuffer( GL_ARRAY_BUFFER, 0 );
+	}
+};
+
+#endif // __BATCH_H__
@@ -0,0 +1,391 @@
+#pragma once
+#ifndef __BELT_H__
+#define __BELT_H__
+
+#include "cgut.h"
+#include "uniform.h"
+#include "shader.h"
+#include "frustum.h"
+#include "ephemeris.h"
+#include <chrono>
+#include <future>
+#include <random>
+
+//*************************************
+// asteroids are positioned in the vertex shader: each instance fetches its elements from a
+// buffer texture and solves Kepler's equation at the simulation clock, so nothing is uploaded
+// per frame; ORDER maps instances to asteroids, so that a draw covers a contiguous run of chunks
+static const char* belt_vert_source = R"(
+#version 330
+layout(location=0) in vec3 position;
+layout(location=1) in vec3 normal;
+
+layout(std140, row_major) uniform Camera { mat4 view_matrix; mat4 projection_matrix; };
+uniform samplerBuffer ELEMENTS;	// two texels per asteroid: (a, e, M0, n) and (i, node, peri, size)
+uniform usamplerBuffer ORDER;	// asteroid ids, chunk by chunk
+uniform int first;				// first entry of ORDER drawn by this call
+uniform float time;				// simulation clock
+
+out vec3 epos;
+out vec3 enorm;
+flat out float tint;
+
+vec3 hash3( uint k )	// pcg3d
+{
+	uvec3 v = uvec3(k,k^0x9e3779b9u,k*0x85ebca6bu)*1664525u+1013904223u;
+	v.x += v.y*v.z; v.y += v.z*v.x; v.z += v.x*v.y; v ^= v>>16u;
+	v.x += v.y*v.z; v.y += v.z*v.x; v.z += v.x*v.y;
+	return vec3(v)*(1.0/4294967296.0);
+}
+
+void main()
+{
+	uint id = texelFetch( ORDER, first+gl_InstanceID ).r;
+	vec4 p0 = texelFetch( ELEMENTS, int(id)*2 ), p1 = texelFetch( ELEMENTS, int(id)*2+1 );
+
+	// eccentric anomaly by Newton's method; belt eccentricities converge in a few iterations
+	float e = p0.y, M = mod(p0.z+p0.w*time,6.2831853), E = M+e*sin(M);
+	for( int k=0; k < 3; k++ ) E -= (E-e*sin(E)-M)/(1.0-e*cos(E));
+	vec2 xy = p0.x*vec2(cos(E)-e,sqrt(1.0-e*e)*sin(E));
+	float ci=cos(p1.x), si=sin(p1.x), cO=cos(p1.y), sO=sin(p1.y), cw=cos(p1.z), sw=sin(p1.z);
+	vec3 P = vec3(cO*cw-sO*sw*ci,sO*cw+cO*sw*ci,sw*si), Q = vec3(-cO*sw-sO*cw*ci,-sO*sw+cO*cw*ci,cw*si);
+
+	// tumbling about a random axis (Rodrigues' rotation)
+	vec3 h = hash3(id), axis = normalize(h*2.0-1.0+vec3(0,0,0.001));
+	float angle = (h.x-0.5)*4.0*time+h.y*6.2831853, c = cos(angle), s = sin(angle);
+	mat3 R = c*mat3(1.0)+s*mat3(0,axis.z,-axis.y,-axis.z,0,axis.x,axis.y,-axis.x,0)+(1.0-c)*outerProduct(axis,axis);
+
+	vec4 ep = view_matrix*vec4(P*xy.x+Q*xy.y+R*(position*p1.w),1);
+	epos = ep.xyz;
+	enorm = mat3(view_matrix)*(R*normal);
+	tint = h.z;
+	gl_Position = projection_matrix*ep;
+}
+)";
+
+static const char* belt_frag_source = R"(
+#version 330
+in vec3 epos;
+in vec3 enorm;
+flat in float tint;
+out vec4 fragColor;
+
+layout(std140, row_major) uniform Camera { mat4 view_matrix; mat4 projection_matrix; };
+layout(std140) uniform Light { vec4 light_position, Ia, Id, Is; };
+
+void main()
+{
+	vec3 n = normalize(enorm), l = normalize((view_matrix*light_position).xyz-epos);
+	vec3 albedo = mix(vec3(0.36,0.33,0.30),vec3(0.58,0.50,0.42),tint);	// gray to brown
+	fragColor = vec4(albedo*(Ia.rgb+max(dot(n,l),0.0)*Id.rgb),1);
+}
+)";
+
+//*************************************
+struct belt_params
+{
+	int		count = 200000;
+	double	inner = 2.1, outer = 3.3;	// semi-major axes of the belt's edges, AU
+	double	jupiter = 5.2;				// semi-major axis of Jupiter, AU; places the Kirkwood gaps
+	double	scale = 1, offset = 0;		// scene units = offset+scale*AU, to fit the belt between the scene's planets
+	double	n_inner = 0.25;				// mean motion at the inner edge; n follows a^-1.5 outwards
+	double	max_e = 0.3, max_i = 0.3;	// largest eccentricity and inclination (radians)
+	float	min_size = 0.004f, max_size = 0.04f;
+	uint32_t seed = 1;
+};
+
+//*************************************
+// instanced asteroid belt: asteroids are bucketed into chunks of a longitude sector, a semi-major
+// axis band and an eccentricity class; chunks are culled by conservative bounds that grow with
+// the time since the bucketing (a group of band and class spans a range of angular velocities),
+// and drawn with one of three meshes by distance, each contiguous run of visible chunks of the
+// same mesh being one instanced call; when the bounds have grown by about a sector, the
+// asteroids are re-bucketed on a worker thread from the SIMD ephemeris, and only ORDER is
+// uploaded again
+struct asteroid_belt
+{
+	enum { SECTORS=64, BANDS=32, CLASSES=4, GROUPS=BANDS*CLASSES, LODS=3 };
+	struct group_t { float a_min, a_max, n_min, n_max, e_max, i_max; int count; };	// of a band and class
+	struct chunk_t { uint32_t first = 0, count = 0; };	// entries of ORDER; sector-major, so the groups of a sector are contiguous
+	struct layout_t
+	{
+		std::vector<uint32_t>	order;
+		std::vector<chunk_t>	chunks;		// SECTORS*GROUPS
+		double					time = 0;	// simulation clock of the bucketing
+		double					cost = 0;	// seconds spent bucketing
+	};
+	struct uniforms { uniform_t ELEMENTS = "ELEMENTS", ORDER = "ORDER", first = "first", time = "time"; };
+	struct stats_t { int draws = 0, chunks = 0, instances = 0, lods[LODS] = { 0, 0, 0 }; int rechunks = 0; double rechunk_cost = 0; };
+
+	belt_params	params;
+	GLuint		program = 0;
+	GLuint		vao[LODS] = { 0, 0, 0 }, mesh[LODS] = { 0, 0, 0 };
+	GLsizei		vertices[LODS] = { 0, 0, 0 };
+	GLuint		element_buffer = 0, element_texture = 0, order_buffer = 0, order_texture = 0;
+	uniforms	u;
+	float		lod_distance[LODS-1] = { 0, 0 };	// beyond these, the next coarser mesh
+
+	ephemeris<float>		eph;		// the same orbits on the CPU; touched only by bucketing
+	std::vector<uint8_t>	group;		// per asteroid
+	group_t					groups[GROUPS];
+	layout_t				layout;		// of the uploaded ORDER
+	std::future<layout_t>	pending;	// bucketing in progress
+	cull_set				bounds;		// per chunk
+	stats_t					stats;		// of the last draw(); rechunks are totals
+	bool					enabled = true;
+
+	bool init( const belt_params& p )
+	{
+		params = p;
+		GLint max_texels=0; glGetIntegerv( GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels );
+		if(max_texels>0&&params.count>max_texels/2){ printf( "> belt: %d asteroids exceed the buffer texture limit; using %d\n", params.count, max_texels/2 ); params.count = max_texels/2; }
+		if(!(program=program_binaries().create( belt_vert_source, belt_frag_source ))){ printf( "%s(): failed to create the belt program\n", __func__ ); return false; }
+		resolve_uniforms( program, u );
+		for( int k=0; k < LODS; k++ ) if(!(vao[k]=create_mesh( 2-k, mesh[k], vertices[k] ))) return false;
+		lod_distance[0] = params.max_size*60.0f; lod_distance[1] = params.max_size*300.0f;	// a few hundred, then a few dozen pixels wide at most
+
+		std::vector<float> elements; generate( elements );
+		element_texture = create_buffer_texture( element_buffer, GL_RGBA32F, elements.size()*sizeof(float), elements.data() );
+		layout = rechunk( 0 );
+		order_texture = create_buffer_texture( order_buffer, GL_R32UI, layout.order.size()*sizeof(uint32_t), layout.order.data() );
+		return element_texture&&order_texture;
+	}
+
+	// view is the camera's view matrix; time is the simulation clock the frame is drawn at
+	void draw( const frustum_t& frustum, bool cull, const mat4& view, double time )
+	{
+		stats.draws = stats.chunks = stats.instances = 0; for( int& l : stats.lods ) l = 0;
+		if(!enabled||!program) return;
+		schedule( time );
+
+		double dt = time-layout.time;
+		bounds.clear();
+		for( int s=0; s < SECTORS; s++ ) for( int g=0; g < GROUPS; g++ ){ vec3 c; float r = bound( s, g, dt, c ); bounds.push( c, r ); }
+		if(cull) bounds.test( frustum ); else bounds.accept_all();
+
+		// eye from the view matrix: -transpose(R)*t
+		vec3 t(view._14,view._24,view._34);
+		vec3 eye(-(view._11*t.x+view._21*t.y+view._31*t.z),-(view._12*t.x+view._22*t.y+view._32*t.z),-(view._13*t.x+view._23*t.y+view._33*t.z));
+
+		// merge contiguous visible chunks of the same mesh into one range of ORDER
+		std::vector<std::pair<uint32_t,uint32_t>> ranges[LODS];	// first, count
+		for( size_t k=0; k < layout.chunks.size(); k++ )
+		{
+			const chunk_t& c = layout.chunks[k];
+			if(!c.count||!bounds.visible[k]) continue;
+			vec3 d = vec3(bounds.x[k],bounds.y[k],bounds.z[k])-eye;
+			float dist = std::max(0.0f,d.length()-bounds.r[k]);
+			int lod = 0; while(lod < LODS-1&&dist>lod_distance[lod]) lod++;
+			auto& r = ranges[lod];
+			if(!r.empty()&&r.back().first+r.back().second==c.first) r.back().second += c.count;
+			else r.emplace_back( c.first, c.count );
+			stats.chunks++; stats.instances += int(c.count); stats.lods[lod] += int(c.count);
+		}
+
+		glUseProgram( program );
+		u.ELEMENTS.set(2); u.ORDER.set(3); u.time.set(float(time));
+		glActiveTexture( GL_TEXTURE3 ); glBindTexture( GL_TEXTURE_BUFFER, order_texture );
+		glActiveTexture( GL_TEXTURE2 ); glBindTexture( GL_TEXTURE_BUFFER, element_texture );
+		for( int l=0; l < LODS; l++ )
+		{
+			if(ranges[l].empty()) continue;
+			glBindVertexArray( vao[l] );
+			for( auto& r : ranges[l] ){ u.first.set(int(r.first)); glDrawArraysInstanced( GL_TRIANGLES, 0, vertices[l], GLsizei(r.second) ); stats.draws++; }
+		}
+		glBindVertexArray( 0 );
+		glBindTexture( GL_TEXTURE_BUFFER, 0 );
+		glActiveTexture( GL_TEXTURE3 ); glBindTexture( GL_TEXTURE_BUFFER, 0 );
+		glActiveTexture( GL_TEXTURE0 );
+	}
+
+	void print_stats()
+	{
+		printf( "> belt: %d asteroids, %d of %d chunks (%d instances) in %d draws; meshes %d/%d/%d; %d rechunks, last %.2f ms\n", params.count, stats.chunks, int(layout.chunks.size()), stats.instances, stats.draws, stats.lods[0], stats.lods[1], stats.lods[2], stats.rechunks, stats.rechunk_cost*1000.0 );
+	}
+
+	void release()
+	{
+		if(pending.valid()) pending.wait();
+		if(program) glDeleteProgram( program );
+		program = 0;
+		glDeleteVertexArrays( LODS, vao ); glDeleteBuffers( LODS, mesh ); for( int k=0; k < LODS; k++ ) vao[k]=mesh[k]=0;
+		GLuint tex[2]={element_texture,order_texture}; glDeleteTextures( 2, tex ); element_texture=order_texture=0;
+		GLuint buf[2]={element_buffer,order_buffer}; glDeleteBuffers( 2, buf ); element_buffer=order_buffer=0;
+	}
+
+protected:
+	double sector_width() const { return 2.0*PI/SECTORS; }
+
+	// asteroids uniform in a, with the Kirkwood gaps (3:1, 5:2, 7:3 and 2:1 resonances with
+	// Jupiter) cleared, and sizes from a power law
+	void generate( std::vector<float>& elements )
+	{
+		std::mt19937 rng(params.seed);
+		std::uniform_real_distribution<double> uniform(0.0,1.0);
+		static const double resonances[] = { 1/3.0, 2/5.0, 3/7.0, 1/2.0 };	// period ratios to Jupiter
+		static const double classes[CLASSES-1] = { 0.04, 0.1, 0.18 };	// upper eccentricities of all but the last class
+		for( auto& g : groups ) g = { 1e9f, -1e9f, 1e9f, -1e9f, 0, 0, 0 };
+		eph.clear(); group.resize(size_t(params.count)); elements.resize(size_t(params.count)*8);
+		for( int k=0; k < params.count; k++ )
+		{
+			orbital_elements o; double au = 0;
+			for( bool gap=true; gap; )
+			{
+				au = params.inner+(params.outer-params.inner)*uniform(rng); gap = false;
+				for( double r : resonances ) gap = gap||fabs(au-params.jupiter*pow(r,2/3.0))<0.02;
+			}
+			o.a = params.offset+params.scale*au;
+			o.e = params.max_e*pow(uniform(rng),1.5); o.i = params.max_i*pow(uniform(rng),2.0);
+			o.node = 2*PI*uniform(rng); o.peri = 2*PI*uniform(rng); o.M0 = 2*PI*uniform(rng);
+			o.n = params.n_inner*pow(au/params.inner,-1.5);
+			float size = std::min(params.max_size,params.min_size*float(pow(1.0-uniform(rng),-1/2.5)));
+			eph.add( o );
+
+			int b = std::min(BANDS-1,int((au-params.inner)/(params.outer-params.inner)*BANDS)), c = 0;
+			while(c < CLASSES-1&&o.e>=classes[c]) c++;
+			group[size_t(k)] = uint8_t(b*CLASSES+c);
+			group_t& t = groups[b*CLASSES+c]; t.count++;
+			t.a_min = std::min(t.a_min,float(o.a)); t.a_max = std::max(t.a_max,float(o.a));
+			t.n_min = std::min(t.n_min,float(o.n)); t.n_max = std::max(t.n_max,float(o.n));
+			t.e_max = std::max(t.e_max,float(o.e)); t.i_max = std::max(t.i_max,float(o.i));
+			float* v = &elements[size_t(k)*8];
+			v[0]=float(o.a); v[1]=float(o.e); v[2]=float(o.M0); v[3]=float(o.n); v[4]=float(o.i); v[5]=float(o.node); v[6]=float(o.peri); v[7]=size;
+		}
+		for( auto& g : groups ) if(!g.count) g = { 0, 0, 0, 0, 0, 0, 0 };
+	}
+
+	// bucket the asteroids by group and by the longitude of their position at time t
+	layout_t rechunk( double t )
+	{
+		auto t0 = std::chrono::steady_clock::now();
+		layout_t l; l.time = t;
+		eph.evaluate( t );
+		std::vector<uint32_t> key(eph.count);
+		l.chunks.assign(SECTORS*GROUPS,chunk_t());
+		for( size_t k=0; k < eph.count; k++ )
+		{
+			int s = int((atan2f(eph.y[k],eph.x[k])+PI)/sector_width()); s = std::min(std::max(s,0),SECTORS-1);
+			key[k] = uint32_t(s*GROUPS+group[k]); l.chunks[key[k]].count++;
+		}
+		uint32_t first = 0; for( auto& c : l.chunks ){ c.first = first; first += c.count; c.count = 0; }
+		l.order.resize(eph.count);
+		for( size_t k=0; k < eph.count; k++ ){ chunk_t& c = l.chunks[key[k]]; l.order[c.first+c.count++] = uint32_t(k); }
+		l.cost = std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+		return l;
+	}
+
+	// take a finished bucketing, or start one when the chunks have widened by a sector on average
+	void schedule( double time )
+	{
+		if(pending.valid())
+		{
+			if(pending.wait_for(std::chrono::seconds(0))!=std::future_status::ready) return;
+			layout = pending.get();
+			glBindBuffer( GL_TEXTURE_BUFFER, order_buffer );
+			glBufferSubData( GL_TEXTURE_BUFFER, 0, GLsizeiptr(layout.order.size()*sizeof(uint32_t)), layout.order.data() );
+			glBindBuffer( GL_TEXTURE_BUFFER, 0 );
+			stats.rechunks++; stats.rechunk_cost = layout.cost;
+			return;
+		}
+		double spread = 0, dt = time-layout.time;	// mean widening of the chunks, over all asteroids
+		for( auto& g : groups ){ double lo, hi; drift( g, dt, lo, hi ); spread += (hi-lo)*g.count; }
+		if(spread>sector_width()*params.count) pending = std::async( std::launch::async, [this,time](){ return rechunk(time); } );
+	}
+
+	// range of the longitude change of a group dt after the bucketing; the angular velocity in
+	// the reference plane lies within n*sqrt((1-e)/(1+e)^3)*cos(i) and n*sqrt((1+e)/(1-e)^3)/cos(i),
+	// and the longitude stays within twice the largest equation of center of the mean longitude
+	static void drift( const group_t& g, double dt, double& lo, double& hi )
+	{
+		double e = g.e_max, ci = cos(g.i_max);
+		double w_min = g.n_min*sqrt((1.0-e)/((1.0+e)*(1.0+e)*(1.0+e)))*ci, w_max = g.n_max*sqrt((1.0+e)/((1.0-e)*(1.0-e)*(1.0-e)))/ci;
+		double m = 2.0*(2.0*e+1.25*e*e+e*e*e)+g.i_max*g.i_max;
+		if(dt>=0){ lo = std::max(w_min*dt,g.n_min*dt-m); hi = std::min(w_max*dt,g.n_max*dt+m); }
+		else{ lo = std::max(w_max*dt,g.n_max*dt-m); hi = std::min(w_min*dt,g.n_min*dt+m); }
+	}
+
+	// bounding sphere of chunk (sector s, group g) dt after the bucketing: the sector widened by
+	// the group's drift, and the group's range of radii and heights
+	float bound( int s, int g, double dt, vec3& center ) const
+	{
+		const group_t& t = groups[g];
+		double lo, hi; drift( t, dt, lo, hi );
+		lo += -PI+s*sector_width(); hi += -PI+(s+1)*sector_width();
+		double r0 = t.a_min*(1.0-t.e_max), r1 = t.a_max*(1.0+t.e_max), z = r1*sin(t.i_max);
+		double c = (lo+hi)*0.5, h = (hi-lo)*0.5;
+		if(h>=PI){ center = vec3(0,0,0); return float(sqrt(r1*r1+z*z))+params.max_size; }
+		double rho = 0.5*(r1+r0*cos(h)), xy = 0;	// midway along the sector's axis
+		for( double r : { r0, r1 } ) for( double a : { 0.0, h } ) xy = std::max(xy,sqrt(r*r+rho*rho-2.0*r*rho*cos(a)));
+		center = vec3(float(rho*cos(c)),float(rho*sin(c)),0);
+		return float(sqrt(xy*xy+z*z))+params.max_size;
+	}
+
+	// unit rocks: an octahedron (detail 0) or an icosahedron subdivided detail-1 times, displaced
+	// by the same function of direction at every detail, with flat normals
+	GLuint create_mesh( int detail, GLuint& buffer, GLsizei& count )
+	{
+		std::vector<vec3> tri;
+		if(detail==0)
+		{
+			vec3 v[6] = { vec3(1,0,0), vec3(-1,0,0), vec3(0,1,0), vec3(0,-1,0), vec3(0,0,1), vec3(0,0,-1) };
+			int f[8][3] = { {0,2,4},{2,1,4},{1,3,4},{3,0,4},{2,0,5},{1,2,5},{3,1,5},{0,3,5} };
+			for( auto& t : f ) for( int j : t ) tri.push_back(v[j]);
+		}
+		else
+		{
+			float g = (1.0f+sqrtf(5.0f))*0.5f;
+			vec3 v[12] = { vec3(-1,g,0), vec3(1,g,0), vec3(-1,-g,0), vec3(1,-g,0), vec3(0,-1,g), vec3(0,1,g), vec3(0,-1,-g), vec3(0,1,-g), vec3(g,0,-1), vec3(g,0,1), vec3(-g,0,-1), vec3(-g,0,1) };
+			int f[20][3] = { {0,11,5},{0,5,1},{0,1,7},{0,7,10},{0,10,11},{1,5,9},{5,11,4},{11,10,2},{10,7,6},{7,1,8},{3,9,4},{3,4,2},{3,2,6},{3,6,8},{3,8,9},{4,9,5},{2,4,11},{6,2,10},{8,6,7},{9,8,1} };
+			for( auto& t : f ) for( int j : t ) tri.push_back(v[j].normalize());
+			for( int d=1; d < detail; d++ )
+			{
+				std::vector<vec3> next;
+				for( size_t k=0; k < tri.size(); k+=3 )
+				{
+					vec3 a=tri[k], b=tri[k+1], c=tri[k+2], ab=(a+b).normalize(), bc=(b+c).normalize(), ca=(c+a).normalize();
+					for( vec3 x : { a,ab,ca, ab,b,bc, ca,bc,c, ab,bc,ca } ) next.push_back(x);
+				}
+				tri.swap(next);
+			}
+		}
+		std::vector<vertex> vertices(tri.size());
+		for( size_t k=0; k < tri.size(); k++ )
+		{
+			vec3 d = tri[k];
+			float h = sinf(d.x*12.9898f+d.y*78.233f+d.z*37.719f)*43758.5453f; h -= floorf(h);
+			vertices[k].pos = d*(0.75f+0.35f*h); vertices[k].tex = vec2(0);
+		}
+		for( size_t k=0; k < vertices.size(); k+=3 )
+		{
+			vec3 n = (vertices[k+1].pos-vertices[k].pos).cross(vertices[k+2].pos-vertices[k].pos).normalize();
+			for( size_t j=0; j < 3; j++ ) vertices[k+j].norm = n;
+		}
+		count = GLsizei(vertices.size());
+
+		GLuint vao; glGenVertexArrays( 1, &vao ); if(!vao){ printf( "%s(): failed in glGenVertexArrays()\n", __func__ ); return 0; }
+		glGenBuffers( 1, &buffer );
+		glBindVertexArray( vao );
+		glBindBuffer( GL_ARRAY_BUFFER, buffer );
+		glBufferData( GL_ARRAY_BUFFER, sizeof(vertex)*vertices.size(), vertices.data(), GL_STATIC_DRAW );
+		glEnableVertexAttribArray(0); glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*) offsetof(vertex,pos) );
+		glEnableVertexAttribArray(1); glVertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*) offsetof(vertex,norm) );
+		glBindVertexArray( 0 );
+		glBindBuffer( GL_ARRAY_BUFFER, 0 );
+		return vao;
+	}
+
+	static GLuint create_buffer_texture( GLuint& buffer, GLenum format, size_t size, const void* data )
+	{
+		GLuint tex=0; glGenBuffers( 1, &buffer ); glGenTextures( 1, &tex );
+		if(!buffer||!tex){ printf( "%s(): failed to create a buffer texture\n", __func__ ); return 0; }
+		glBindBuffer( GL_TEXTURE_BUFFER, buffer );
+		glBufferData( GL_TEXTURE_BUFFER, GLsizeiptr(size), data, GL_STATIC_DRAW );
+		glBindTexture( GL_TEXTURE_BUFFER, tex );
+		glTexBuffer( GL_TEXTURE_BUFFER, format, buffer );
+		glBindTexture( GL_TEXTURE_BUFFER, 0 );
+		glBindBuffer( GL_TEXTURE_BUFFER, 0 );
+		return tex;
+	}
+};
+
+#endif // __BELT_H__
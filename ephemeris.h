@@ -0,0 +1,219 @@
+#pragma once
+#ifndef __EPHEMERIS_H__
+#define __EPHEMERIS_H__
+
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+#include <type_traits>
+#include <vector>
+
+#if defined(__AVX__)
+	#include <immintrin.h>
+	#define EPHEMERIS_AVX
+#elif defined(__SSE2__)||defined(_M_X64)||(defined(_M_IX86_FP)&&_M_IX86_FP>=2)
+	#include <emmintrin.h>
+	#define EPHEMERIS_SSE2
+#endif
+
+//*************************************
+// classical orbital elements of a body around its primary; angles in radians
+struct orbital_elements
+{
+	double	a = 1;		// semi-major axis
+	double	e = 0;		// eccentricity in [0,1)
+	double	i = 0;		// inclination to the reference (xy) plane
+	double	node = 0;	// longitude of the ascending node
+	double	peri = 0;	// argument of periapsis
+	double	M0 = 0;		// mean anomaly at t=0
+	double	n = 1;		// mean motion, radians per unit of time; sqrt(mu/a^3) for a gravitational parameter mu
+};
+
+//*************************************
+// SIMD lanes: one set of operations per vector type, so that the Kepler solver below is written
+// once and runs on 8 (AVX) or 4 (SSE2) floats, 4 or 2 doubles, or one scalar for the tail
+template <class T> struct scalar_lanes
+{
+	typedef T V; typedef bool M; enum { width=1 };
+	static V load( const T* p ){ return *p; }
+	static void store( T* p, V v ){ *p = v; }
+	static V set( T s ){ return s; }
+	static V add( V a, V b ){ return a+b; }
+	static V sub( V a, V b ){ return a-b; }
+	static V mul( V a, V b ){ return a*b; }
+	static V div( V a, V b ){ return a/b; }
+	static V round( V a ){ return std::nearbyint(a); }
+	static V abs( V a ){ return std::fabs(a); }
+	static M gt( V a, V b ){ return a>b; }
+	static V select( M m, V a, V b ){ return m ? a : b; }	// m ? a : b per lane
+	static bool any( M m ){ return m; }
+};
+
+#if defined(EPHEMERIS_AVX)
+template <class T> struct simd_lanes;
+template <> struct simd_lanes<float>
+{
+	typedef __m256 V; typedef __m256 M; enum { width=8 };
+	static V load( const float* p ){ return _mm256_loadu_ps(p); }
+	static void store( float* p, V v ){ _mm256_storeu_ps(p,v); }
+	static V set( float s ){ return _mm256_set1_ps(s); }
+	static V add( V a, V b ){ return _mm256_add_ps(a,b); }
+	static V sub( V a, V b ){ return _mm256_sub_ps(a,b); }
+	static V mul( V a, V b ){ return _mm256_mul_ps(a,b); }
+	static V div( V a, V b ){ return _mm256_div_ps(a,b); }
+	static V round( V a ){ return _mm256_round_ps(a,_MM_FROUND_TO_NEAREST_INT|_MM_FROUND_NO_EXC); }
+	static V abs( V a ){ return _mm256_andnot_ps(_mm256_set1_ps(-0.0f),a); }
+	static M gt( V a, V b ){ return _mm256_cmp_ps(a,b,_CMP_GT_OQ); }
+	static V select( M m, V a, V b ){ return _mm256_blendv_ps(b,a,m); }
+	static bool any( M m ){ return _mm256_movemask_ps(m)!=0; }
+};
+template <> struct simd_lanes<double>
+{
+	typedef __m256d V; typedef __m256d M; enum { width=4 };
+	static V load( const double* p ){ return _mm256_loadu_pd(p); }
+	static void store( double* p, V v ){ _mm256_storeu_pd(p,v); }
+	static V set( double s ){ return _mm256_set1_pd(s); }
+	static V add( V a, V b ){ return _mm256_add_pd(a,b); }
+	static V sub( V a, V b ){ return _mm256_sub_pd(a,b); }
+	static V mul( V a, V b ){ return _mm256_mul_pd(a,b); }
+	static V div( V a, V b ){ return _mm256_div_pd(a,b); }
+	static V round( V a ){ return _mm256_round_pd(a,_MM_FROUND_TO_NEAREST_INT|_MM_FROUND_NO_EXC); }
+	static V abs( V a ){ return _mm256_andnot_pd(_mm256_set1_pd(-0.0),a); }
+	static M gt( V a, V b ){ return _mm256_cmp_pd(a,b,_CMP_GT_OQ); }
+	static V select( M m, V a, V b ){ return _mm256_blendv_pd(b,a,m); }
+	static bool any( M m ){ return _mm256_movemask_pd(m)!=0; }
+};
+#elif defined(EPHEMERIS_SSE2)
+template <class T> struct simd_lanes;
+template <> struct simd_lanes<float>
+{
+	typedef __m128 V; typedef __m128 M; enum { width=4 };
+	static V load( const float* p ){ return _mm_loadu_ps(p); }
+	static void store( float* p, V v ){ _mm_storeu_ps(p,v); }
+	static V set( float s ){ return _mm_set1_ps(s); }
+	static V add( V a, V b ){ return _mm_add_ps(a,b); }
+	static V sub( V a, V b ){ return _mm_sub_ps(a,b); }
+	static V mul( V a, V b ){ return _mm_mul_ps(a,b); }
+	static V div( V a, V b ){ return _mm_div_ps(a,b); }
+	static V round( V a ){ return _mm_cvtepi32_ps(_mm_cvtps_epi32(a)); }	// angles over 2pi stay far below 2^31
+	static V abs( V a ){ return _mm_andnot_ps(_mm_set1_ps(-0.0f),a); }
+	static M gt( V a, V b ){ return _mm_cmpgt_ps(a,b); }
+	static V select( M m, V a, V b ){ return _mm_or_ps(_mm_and_ps(m,a),_mm_andnot_ps(m,b)); }
+	static bool any( M m ){ return _mm_movemask_ps(m)!=0; }
+};
+template <> struct simd_lanes<double>
+{
+	typedef __m128d V; typedef __m128d M; enum { width=2 };
+	static V load( const double* p ){ return _mm_loadu_pd(p); }
+	static void store( double* p, V v ){ _mm_storeu_pd(p,v); }
+	static V set( double s ){ return _mm_set1_pd(s); }
+	static V add( V a, V b ){ return _mm_add_pd(a,b); }
+	static V sub( V a, V b ){ return _mm_sub_pd(a,b); }
+	static V mul( V a, V b ){ return _mm_mul_pd(a,b); }
+	static V div( V a, V b ){ return _mm_div_pd(a,b); }
+	static V round( V a ){ return _mm_cvtepi32_pd(_mm_cvtpd_epi32(a)); }
+	static V abs( V a ){ return _mm_andnot_pd(_mm_set1_pd(-0.0),a); }
+	static M gt( V a, V b ){ return _mm_cmpgt_pd(a,b); }
+	static V select( M m, V a, V b ){ return _mm_or_pd(_mm_and_pd(m,a),_mm_andnot_pd(m,b)); }
+	static bool any( M m ){ return _mm_movemask_pd(m)!=0; }
+};
+#endif
+
+// sine and cosine of any angle per lane: wrapped to [-pi,pi], folded to [-pi/2,pi/2], then
+// Taylor polynomials to x^17/x^18, accurate to about 1e-15 there
+template <class L, class T> inline void lane_sincos( typename L::V x, typename L::V& s, typename L::V& c )
+{
+	typedef typename L::V V;
+	const T pi = T(3.14159265358979323846);
+	x = L::sub( x, L::mul( L::set(2*pi), L::round(L::mul(x,L::set(T(1)/(2*pi)))) ) );
+	typename L::M far = L::gt( L::abs(x), L::set(pi/2) );
+	V y = L::select( far, L::sub( L::select(L::gt(x,L::set(0)),L::set(pi),L::set(-pi)), x ), x );	// sin(pi-x) = sin(x)
+	V z = L::mul(y,y);
+	static const T sk[] = { T(1/355687428096000.0), T(-1/1307674368000.0), T(1/6227020800.0), T(-1/39916800.0), T(1/362880.0), T(-1/5040.0), T(1/120.0), T(-1/6.0), T(1) };
+	static const T ck[] = { T(-1/6402373705728000.0), T(1/20922789888000.0), T(-1/87178291200.0), T(1/479001600.0), T(-1/3628800.0), T(1/40320.0), T(-1/720.0), T(1/24.0), T(-1/2.0), T(1) };
+	V ps = L::set(sk[0]); for( int k=1; k < 9; k++ ) ps = L::add( L::mul(ps,z), L::set(sk[k]) );
+	V pc = L::set(ck[0]); for( int k=1; k < 10; k++ ) pc = L::add( L::mul(pc,z), L::set(ck[k]) );
+	s = L::mul(ps,y);
+	c = L::select( far, L::sub(L::set(0),pc), pc );	// cos(pi-x) = -cos(x)
+}
+
+//*************************************
+// ephemeris of many bodies in structure-of-arrays layout; evaluate(t) solves Kepler's equation
+// M = E - e sin(E) for every body with Newton iterations in SIMD lanes, then places it on its
+// ellipse; T is float (twice the lanes) or double (for long time spans: float mean anomalies
+// lose a milliradian per ~10^4 radians of n*t)
+template <class T> struct ephemeris
+{
+	std::vector<T>	M0, n, e, a, b;					// b: semi-minor axis
+	std::vector<T>	px, py, pz, qx, qy, qz;			// perifocal axes in the reference frame: periapsis, and 90 degrees ahead
+	std::vector<T>	x, y, z;						// positions of the last evaluate()
+	size_t			count = 0;
+	T				tolerance = std::is_same<T,float>::value ? T(1e-6) : T(1e-12);	// radians of E
+	int				max_iterations = 16;
+	int				iterations = 0;					// most Newton iterations a batch needed in the last evaluate()
+
+	void clear(){ count = 0; for( auto* v : arrays() ) v->clear(); x.clear(); y.clear(); z.clear(); }
+
+	// the element arrays grow by whole batches of 8, so they are always padded for the widest lanes;
+	// padding bodies have a=b=0 and sit at the origin, and the returned index is the body's slot
+	size_t add( const orbital_elements& o )
+	{
+		if(count==M0.size()) for( auto* v : arrays() ) v->resize(count+8,0);
+		double cO=cos(o.node), sO=sin(o.node), cw=cos(o.peri), sw=sin(o.peri), ci=cos(o.i), si=sin(o.i);
+		size_t k = count;
+		M0[k]=T(o.M0); n[k]=T(o.n); e[k]=T(o.e); a[k]=T(o.a); b[k]=T(o.a*sqrt(1-o.e*o.e));
+		px[k]=T(cO*cw-sO*sw*ci); py[k]=T(sO*cw+cO*sw*ci); pz[k]=T(sw*si);
+		qx[k]=T(-cO*sw-sO*cw*ci); qy[k]=T(-sO*sw+cO*cw*ci); qz[k]=T(cw*si);
+		return count++;
+	}
+
+	// positions of all bodies at time t into x, y and z; simd=false runs the scalar lanes only
+	void evaluate( double t, bool simd=true )
+	{
+		size_t padded = M0.size();	// a multiple of 8, kept by add()
+		x.resize(padded); y.resize(padded); z.resize(padded);
+		iterations = 0;
+		size_t k = 0;
+#if defined(EPHEMERIS_AVX)||defined(EPHEMERIS_SSE2)
+		if(simd) k = solve<simd_lanes<T>>( 0, padded, T(t) );
+#endif
+		solve<scalar_lanes<T>>( k, count, T(t) );
+		x.resize(count); y.resize(count); z.resize(count);
+	}
+
+protected:
+	std::vector<std::vector<T>*> arrays(){ return { &M0, &n, &e, &a, &b, &px, &py, &pz, &qx, &qy, &qz }; }
+
+	// batches of L::width bodies from k while they fit before end; returns where it stopped
+	template <class L> size_t solve( size_t k, size_t end, T t )
+	{
+		typedef typename L::V V;
+		const T pi = T(3.14159265358979323846);
+		const V tv=L::set(t), one=L::set(T(1)), tol=L::set(tolerance), zero=L::set(T(0));
+		for( ; k+L::width <= end; k+=L::width )
+		{
+			V ek = L::load(&e[k]), s, c;
+			V M = L::add( L::load(&M0[k]), L::mul(L::load(&n[k]),tv) );
+			M = L::sub( M, L::mul( L::set(2*pi), L::round(L::mul(M,L::set(T(1)/(2*pi)))) ) );	// [-pi,pi]
+			lane_sincos<L,T>( M, s, c );
+			V E = L::select( L::gt(ek,L::set(T(0.8))), L::select(L::gt(M,zero),L::set(pi),L::set(-pi)), L::add(M,L::mul(ek,s)) );	// starting guesses that converge for any e<1
+			int it = 0;
+			while(it < max_iterations)
+			{
+				lane_sincos<L,T>( E, s, c );
+				V d = L::div( L::sub(L::sub(E,L::mul(ek,s)),M), L::sub(one,L::mul(ek,c)) );
+				E = L::sub(E,d); it++;
+				if(!L::any(L::gt(L::abs(d),tol))) break;
+			}
+			iterations = std::max(iterations,it);
+			lane_sincos<L,T>( E, s, c );
+			V X = L::mul( L::load(&a[k]), L::sub(c,ek) ), Y = L::mul( L::load(&b[k]), s );	// on the ellipse, in the perifocal frame
+			L::store( &x[k], L::add(L::mul(X,L::load(&px[k])),L::mul(Y,L::load(&qx[k]))) );
+			L::store( &y[k], L::add(L::mul(X,L::load(&py[k])),L::mul(Y,L::load(&qy[k]))) );
+			L::store( &z[k], L::add(L::mul(X,L::load(&pz[k])),L::mul(Y,L::load(&qz[k]))) );
+		}
+		return k;
+	}
+};
+
+#endif // __EPHEMERIS_H__
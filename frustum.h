@@ -0,0 +1,105 @@
+#pragma once
+#ifndef __FRUSTUM_H__
+#define __FRUSTUM_H__
+
+#include "cgmath.h"
+#include <stdint.h>
+#include <vector>
+
+#if defined(__AVX__)
+	#include <immintrin.h>
+	#define FRUSTUM_AVX
+#elif defined(__SSE__)||defined(_M_X64)||(defined(_M_IX86_FP)&&_M_IX86_FP>=1)
+	#include <xmmintrin.h>
+	#define FRUSTUM_SSE
+#endif
+
+//*************************************
+// six planes (a,b,c,d) of a view frustum, normalized so that a*x+b*y+c*z+d is the
+// signed distance to the plane; positive inside
+struct frustum_t
+{
+	vec4	planes[6];	// left, right, bottom, top, near, far
+
+	// extract from projection*view; mat4 is row-major, so clip = m*p uses the rows
+	void extract( const mat4& m )
+	{
+		vec4 r0(m._11,m._12,m._13,m._14), r1(m._21,m._22,m._23,m._24), r2(m._31,m._32,m._33,m._34), r3(m._41,m._42,m._43,m._44);
+		planes[0]=r3+r0; planes[1]=r3-r0; planes[2]=r3+r1; planes[3]=r3-r1; planes[4]=r3+r2; planes[5]=r3-r2;
+		for( auto& p : planes ){ float l=sqrtf(p.x*p.x+p.y*p.y+p.z*p.z); if(l>0) p=p*(1.0f/l); }
+	}
+};
+
+// origin and largest axis scale of a model matrix, to place and size a bounding sphere
+inline vec3 matrix_origin( const mat4& m ){ return vec3(m._14,m._24,m._34); }
+inline float matrix_scale( const mat4& m )
+{
+	float x=m._11*m._11+m._21*m._21+m._31*m._31, y=m._12*m._12+m._22*m._22+m._32*m._32, z=m._13*m._13+m._23*m._23+m._33*m._33;
+	return sqrtf(std::max(x,std::max(y,z)));
+}
+
+//*************************************
+// bounding spheres in structure-of-arrays layout, tested against a frustum in batches
+// of 8 (AVX) or 4 (SSE) spheres per plane
+struct cull_set
+{
+	std::vector<float>		x, y, z, r;		// padded to a multiple of 8
+	std::vector<uint8_t>	visible;		// result of the last test(); one per sphere
+	size_t					count = 0;
+	int						culled = 0;		// of the last test()
+
+	void clear(){ count=0; x.clear(); y.clear(); z.clear(); r.clear(); }
+
+	// returns the index of the sphere in visible[]
+	size_t push( const vec3& center, float radius )
+	{
+		x.push_back(center.x); y.push_back(center.y); z.push_back(center.z); r.push_back(radius);
+		return count++;
+	}
+
+	// mark every sphere visible without testing, e.g., when culling is off
+	void accept_all(){ visible.assign(count,1); culled=0; }
+
+	void test( const frustum_t& f )
+	{
+		size_t n = (count+7)&~size_t(7);	// padding spheres lie at the origin with radius 0
+		x.resize(n,0); y.resize(n,0); z.resize(n,0); r.resize(n,0);
+		visible.assign(n,1);
+		size_t k=0;
+#if defined(FRUSTUM_AVX)
+		for( ; k < n; k+=8 )
+		{
+			__m256 sx=_mm256_loadu_ps(&x[k]), sy=_mm256_loadu_ps(&y[k]), sz=_mm256_loadu_ps(&z[k]), nr=_mm256_sub_ps(_mm256_setzero_ps(),_mm256_loadu_ps(&r[k]));
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for( auto& p : f.planes )
+			{
+				__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(p.x),sx),_mm256_mul_ps(_mm256_set1_ps(p.y),sy)),_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(p.z),sz),_mm256_set1_ps(p.w)));
+				inside = _mm256_and_ps(inside,_mm256_cmp_ps(d,nr,_CMP_GE_OQ));
+			}
+			int mask = _mm256_movemask_ps(inside);
+			for( int j=0; j < 8; j++ ) visible[k+j] = uint8_t((mask>>j)&1);
+		}
+#elif defined(FRUSTUM_SSE)
+		for( ; k < n; k+=4 )
+		{
+			__m128 sx=_mm_loadu_ps(&x[k]), sy=_mm_loadu_ps(&y[k]), sz=_mm_loadu_ps(&z[k]), nr=_mm_sub_ps(_mm_setzero_ps(),_mm_loadu_ps(&r[k]));
+			__m128 inside = _mm_cmpeq_ps(sx,sx);	// all ones
+			for( auto& p : f.planes )
+			{
+				__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.x),sx),_mm_mul_ps(_mm_set1_ps(p.y),sy)),_mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.z),sz),_mm_set1_ps(p.w)));
+				inside = _mm_and_ps(inside,_mm_cmpge_ps(d,nr));
+			}
+			int mask = _mm_movemask_ps(inside);
+			for( int j=0; j < 4; j++ ) visible[k+j] = uint8_t((mask>>j)&1);
+		}
+#endif
+		for( ; k < n; k++ )
+		{
+			for( auto& p : f.planes ) if(p.x*x[k]+p.y*y[k]+p.z*z[k]+p.w<-r[k]){ visible[k]=0; break; }
+		}
+		visible.resize(count);
+		culled = 0; for( auto v : visible ) culled += v?0:1;
+	}
+};
+
+#endif // __FRUSTUM_H__
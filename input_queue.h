@@ -0,0 +1,58 @@
+#pragma once
+#ifndef __INPUT_QUEUE_H__
+#define __INPUT_QUEUE_H__
+
+#include "cgmath.h"
+#include <algorithm>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+//*************************************
+// per-frame pointer input: callbacks only append events, and consecutive cursor events are
+// merged into the latest position; apply() replays the queue in order once per frame, so the
+// trackball is evaluated once per drag segment instead of once per cursor callback
+struct input_queue
+{
+	enum { BUTTON=1, CURSOR=2 };
+	struct event { int type; int button, action, mods; dvec2 pos; };
+	struct stats_t
+	{
+		int64_t	callbacks = 0;		// button and cursor callbacks received
+		int64_t	coalesced = 0;		// cursor events merged into a later one
+		int64_t	evaluations = 0;	// trackball updates applied
+		int64_t	frames = 0;			// calls of apply()
+	};
+
+	std::vector<event>	events;
+	bool				coalesce = true;	// false: every cursor event is applied (the per-event path)
+	stats_t				stats;				// totals since the last reset
+
+	void button( int button, int action, int mods, dvec2 pos ){ stats.callbacks++; events.push_back({ BUTTON, button, action, mods, pos }); }
+	void cursor( dvec2 pos )
+	{
+		stats.callbacks++;
+		if(coalesce&&!events.empty()&&events.back().type==CURSOR){ events.back().pos = pos; stats.coalesced++; return; }
+		events.push_back({ CURSOR, 0, 0, 0, pos });
+	}
+
+	// on_button(event) for button events, and on_cursor(pos) for cursor events; on_cursor returns
+	// whether it evaluated the trackball; call once per frame before update(), and before any
+	// other input (e.g., a modifier key) that changes how the queued events are interpreted,
+	// with frame=false for such mid-frame flushes
+	template <class B, class C> void apply( B on_button, C on_cursor, bool frame=true )
+	{
+		for( auto& e : events ){ if(e.type==BUTTON) on_button(e); else if(on_cursor(e.pos)) stats.evaluations++; }
+		events.clear();
+		if(frame) stats.frames++;
+	}
+
+	void print_stats()
+	{
+		double n = double(std::max(stats.frames,int64_t(1)));
+		printf( "> input: %.2f callbacks and %.2f trackball evaluations per frame; %lld cursor events coalesced%s\n", stats.callbacks/n, stats.evaluations/n, (long long) stats.coalesced, coalesce ? "" : " (per-event path)" );
+	}
+	void reset(){ stats = stats_t(); }
+};
+
+#endif // __INPUT_QUEUE_H__
@@ -0,0 +1,138 @@
+#pragma once
+#ifndef __OFFSCREEN_H__
+#define __OFFSCREEN_H__
+
+#include "cgut.h"
+#include <algorithm>
+
+//*************************************
+// offscreen render target: an RGBA8 color texture and a 24-bit depth renderbuffer
+struct render_target
+{
+	GLuint	fbo = 0;
+	GLuint	color = 0;		// sampleable, e.g., by an upscaling pass
+	GLuint	depth = 0;
+	int		width = 0, height = 0;
+	int		used_width = 0, used_height = 0;	// region drawn by bind(); smaller when resolution is scaled
+
+	bool create( int w, int h )
+	{
+		release();
+		width = used_width = w; height = used_height = h;
+		glGenTextures( 1, &color );
+		glBindTexture( GL_TEXTURE_2D, color );
+		glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+		glBindTexture( GL_TEXTURE_2D, 0 );
+
+		glGenRenderbuffers( 1, &depth );
+		glBindRenderbuffer( GL_RENDERBUFFER, depth );
+		glRenderbufferStorage( GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h );
+		glBindRenderbuffer( GL_RENDERBUFFER, 0 );
+
+		glGenFramebuffers( 1, &fbo );
+		glBindFramebuffer( GL_FRAMEBUFFER, fbo );
+		glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0 );
+		glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth );
+		GLenum status = glCheckFramebufferStatus( GL_FRAMEBUFFER );
+		glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+		if(status!=GL_FRAMEBUFFER_COMPLETE){ printf( "%s(): incomplete framebuffer (0x%04x) at %dx%d\n", __func__, status, w, h ); release(); return false; }
+		return true;
+	}
+
+	// draw into the target; the viewport covers the used region
+	void bind(){ glBindFramebuffer( GL_FRAMEBUFFER, fbo ); glViewport( 0, 0, used_width, used_height ); }
+	void set_scale( float s ){ used_width = std::max(1,int(width*s+0.5f)); used_height = std::max(1,int(height*s+0.5f)); }
+
+	// tightly packed RGB rows, top row first
+	void read( std::vector<unsigned char>& rgb )
+	{
+		rgb.resize(size_t(width)*height*3);
+		std::vector<unsigned char> row(size_t(width)*3);
+		glBindFramebuffer( GL_READ_FRAMEBUFFER, fbo );
+		glPixelStorei( GL_PACK_ALIGNMENT, 1 );
+		glReadPixels( 0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, rgb.data() );
+		for( int y=0; y < height/2; y++ )
+		{
+			unsigned char *a=&rgb[size_t(y)*width*3], *b=&rgb[size_t(height-1-y)*width*3];
+			memcpy(row.data(),a,row.size()); memcpy(a,b,row.size()); memcpy(b,row.data(),row.size());
+		}
+	}
+
+	void release()
+	{
+		if(fbo) glDeleteFramebuffers( 1, &fbo );
+		if(color) glDeleteTextures( 1, &color );
+		if(depth) glDeleteRenderbuffers( 1, &depth );
+		fbo = color = depth = 0;
+	}
+};
+
+//*************************************
+// dynamic resolution: GPU time of the scene, from timestamp queries read back a few frames
+// later, drives the render scale toward a target frame time; the scale holds while the time
+// is within a band around the target, and waits a few frames after each change
+struct resolution_controller
+{
+	enum { LATENCY=4 };				// frames of query slots in flight
+
+	float	target_ms = 16.0f;
+	float	hysteresis = 0.15f;		// relative half-width of the band
+	float	min_scale = 0.5f, max_scale = 1.0f, step = 0.05f;
+	float	scale = 1.0f;
+	float	gpu_ms = 0;				// smoothed GPU time of the scene
+	int		cooldown = 0;
+	GLuint	queries[LATENCY][2] = {};
+	int64_t	frame = 0;
+
+	void begin_frame()
+	{
+		if(!queries[0][0]) glGenQueries( LATENCY*2, &queries[0][0] );
+		glQueryCounter( queries[frame%LATENCY][0], GL_TIMESTAMP );
+	}
+
+	// true when the scale changed
+	bool end_frame()
+	{
+		glQueryCounter( queries[frame%LATENCY][1], GL_TIMESTAMP );
+		int64_t oldest = ++frame-LATENCY;	// issued LATENCY-1 frames before this one, and reused by the next begin_frame()
+		if(oldest<0) return false;
+		GLuint* q = queries[oldest%LATENCY];
+		GLuint available=0; glGetQueryObjectuiv( q[1], GL_QUERY_RESULT_AVAILABLE, &available );
+		if(available)	// otherwise the sample is dropped, rather than stalling on the GPU
+		{
+			GLuint64 t0=0, t1=0;
+			glGetQueryObjectui64v( q[0], GL_QUERY_RESULT, &t0 );
+			glGetQueryObjectui64v( q[1], GL_QUERY_RESULT, &t1 );
+			float ms = float(double(t1-t0)*1e-6);
+			gpu_ms = gpu_ms>0 ? gpu_ms*0.8f+ms*0.2f : ms;
+		}
+		if(gpu_ms<=0) return false;
+
+		if(cooldown>0){ cooldown--; return false; }
+		if(gpu_ms<target_ms*(1+hysteresis)&&(gpu_ms>target_ms*(1-hysteresis)||scale>=max_scale)) return false;
+		float s = scale*sqrtf(target_ms/std::max(gpu_ms,0.01f));	// pixels scale with scale^2
+		s = std::min(max_scale,std::max(min_scale,floorf(s/step+0.5f)*step));
+		if(fabsf(s-scale)<step*0.5f) return false;
+		scale = s; cooldown = LATENCY*2;
+		return true;
+	}
+
+	void reset(){ scale = max_scale; gpu_ms = 0; cooldown = 0; frame = 0; }
+	void release(){ if(queries[0][0]) glDeleteQueries( LATENCY*2, &queries[0][0] ); memset( queries, 0, sizeof(queries) ); frame = 0; }
+};
+
+// binary PPM; readable by most image tools without another dependency
+inline bool write_ppm( const char* path, int width, int height, const std::vector<unsigned char>& rgb )
+{
+	FILE* fp = fopen( path, "wb" ); if(!fp){ printf( "%s(): unable to open %s\n", __func__, path ); return false; }
+	fprintf( fp, "P6\n%d %d\n255\n", width, height );
+	size_t n = fwrite( rgb.data(), 1, rgb.size(), fp );
+	fclose( fp );
+	return n==rgb.size();
+}
+
+#endif // __OFFSCREEN_H__
@@ -0,0 +1,136 @@
+#pragma once
+#ifndef __PACING_H__
+#define __PACING_H__
+
+#include "cgut.h"
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <thread>
+
+//*************************************
+// frame pacing: the swap interval, an optional sleep-based frame cap, and a low-latency mode
+// that waits for each present (glFinish after the swap, so the driver cannot queue frames
+// ahead) and then sleeps until just before the next one, so that input and the camera are
+// sampled as late as possible; measures present-to-present times and input-to-present latency
+//
+// the loop is: wait(); glfwPollEvents(); input_sampled(); update(); render(); presented();
+struct frame_pacer
+{
+	enum { FRAMES=240 };			// frames kept for the statistics
+
+	int		swap_interval = 1;		// 0: immediate, 1: every vertical blank, ...
+	double	fps_cap = 0;			// frames per second; 0: uncapped
+	bool	low_latency = false;
+	double	margin = 0.002;			// seconds kept between the predicted end of a frame and the next vertical blank
+
+	std::vector<double>	intervals = std::vector<double>(FRAMES,0);	// present-to-present, seconds
+	std::vector<double>	latencies = std::vector<double>(FRAMES,0);	// input-to-present, seconds
+	int64_t	frames = 0, measured = 0;
+	double	input_time = 0, last_present = -1, next_start = -1;
+	double	work = 0;				// smoothed input-to-present time of low-latency frames
+	double	sleep_time = 0;			// seconds slept by the last wait()
+	std::deque<std::pair<GLsync,double>> fences;	// frames in flight, and when their input was sampled
+
+	// --swap-interval <n>, --fps-cap <fps>, --low-latency
+	void parse( int argc, char* argv[] )
+	{
+		for( int k=1; k < argc; k++ )
+		{
+			if(strcmp(argv[k],"--low-latency")==0) low_latency = true;
+			else if(k+1<argc&&strcmp(argv[k],"--swap-interval")==0) swap_interval = atoi(argv[k+1]);
+			else if(k+1<argc&&strcmp(argv[k],"--fps-cap")==0) fps_cap = atof(argv[k+1]);
+		}
+	}
+
+	// after the context is current
+	void init(){ set_swap_interval( swap_interval ); }
+	void set_swap_interval( int n ){ swap_interval = n; glfwSwapInterval( n ); }
+
+	// seconds between vertical blanks of the primary monitor; 60 Hz when unknown
+	double refresh_period()
+	{
+		GLFWmonitor* m = glfwGetPrimaryMonitor(); const GLFWvidmode* v = m ? glfwGetVideoMode(m) : nullptr;
+		return v&&v->refreshRate>0 ? 1.0/v->refreshRate : 1.0/60.0;
+	}
+
+	// before polling input
+	void wait()
+	{
+		double now = glfwGetTime(), target = now;
+		if(fps_cap>0){ next_start = next_start<0||next_start<now-1.0/fps_cap ? now : next_start+1.0/fps_cap; target = next_start; }
+		if(low_latency&&swap_interval>0&&last_present>=0) target = std::max( target, last_present+refresh_period()*swap_interval-work-margin );
+		sleep_time = target-now; if(sleep_time<=0){ sleep_time = 0; return; }
+		if(sleep_time>0.002) std::this_thread::sleep_for( std::chrono::duration<double>(sleep_time-0.001) );	// the scheduler overshoots by up to a millisecond
+		while(glfwGetTime()<target) std::this_thread::yield();
+	}
+
+	void input_sampled(){ input_time = glfwGetTime(); }
+
+	// after the swap
+	void presented()
+	{
+		if(low_latency)
+		{
+			glFinish();
+			double now = glfwGetTime();
+			work = work>0 ? work*0.9+(now-input_time)*0.1 : now-input_time;
+			record_latency( now-input_time );
+		}
+		else
+		{
+			// the frame has been presented no later than its fence signals; checked without blocking
+			fences.emplace_back( glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 ), input_time );
+			while(!fences.empty())
+			{
+				GLenum r = glClientWaitSync( fences.front().first, 0, 0 );
+				if(r!=GL_ALREADY_SIGNALED&&r!=GL_CONDITION_SATISFIED&&fences.size()<8) break;
+				if(r==GL_ALREADY_SIGNALED||r==GL_CONDITION_SATISFIED) record_latency( glfwGetTime()-fences.front().second );
+				glDeleteSync( fences.front().first ); fences.pop_front();
+			}
+		}
+		double now = glfwGetTime();
+		if(last_present>=0) intervals[size_t(frames++%FRAMES)] = now-last_present;
+		last_present = now;
+	}
+
+	// mean, deviation and p99 of the frame times, and the mean/p95 latency
+	void print_stats()
+	{
+		auto summary = []( std::vector<double> v, int64_t n, double& mean, double& dev, double& p95, double& p99 )
+		{
+			v.resize(size_t(std::min(n,int64_t(FRAMES)))); mean = dev = p95 = p99 = 0; if(v.empty()) return;
+			for( double x : v ) mean += x;
+			mean /= v.size();
+			for( double x : v ) dev += (x-mean)*(x-mean);
+			dev = sqrt(dev/v.size());
+			std::sort( v.begin(), v.end() );
+			p95 = v[std::min(v.size()-1,size_t(0.95*v.size()))]; p99 = v[std::min(v.size()-1,size_t(0.99*v.size()))];
+		};
+		double m, d, p95, p99;
+		summary( intervals, frames, m, d, p95, p99 );
+		char cap[32] = "uncapped"; if(fps_cap>0) snprintf( cap, sizeof(cap), "capped at %g fps", fps_cap );
+		printf( "> frame pacing: swap interval %d, %s, %s\n", swap_interval, cap, low_latency ? "low latency" : "queued" );
+		printf( ">   frame time %.2f ms, deviation %.2f ms, p99 %.2f ms over %d frames\n", m*1000.0, d*1000.0, p99*1000.0, int(std::min(frames,int64_t(FRAMES))) );
+		summary( latencies, measured, m, d, p95, p99 );
+		printf( ">   input-to-present %.2f ms, p95 %.2f ms%s\n", m*1000.0, p95*1000.0, low_latency ? "" : " (upper bound: fences are checked once per frame)" );
+	}
+
+	// F5: statistics, F6: cycle the swap interval, F7: low-latency mode; true when handled
+	bool keyboard( int key )
+	{
+		if(key==GLFW_KEY_F5) print_stats();
+		else if(key==GLFW_KEY_F6){ set_swap_interval( (swap_interval+1)%3 ); reset(); printf( "> swap interval %d\n", swap_interval ); }
+		else if(key==GLFW_KEY_F7){ low_latency = !low_latency; reset(); printf( "> %s frame pacing\n", low_latency ? "low-latency" : "queued" ); }
+		else return false;
+		return true;
+	}
+
+	void reset(){ frames = measured = 0; work = 0; last_present = next_start = -1; }
+	void release(){ for( auto& f : fences ) glDeleteSync( f.first ); fences.clear(); }
+
+protected:
+	void record_latency( double t ){ latencies[size_t(measured++%FRAMES)] = t; }
+};
+
+#endif // __PACING_H__
@@ -0,0 +1,208 @@
+#pragma once
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include "cgut.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+
+//*************************************
+// a timed scope of one frame; gpu is the GL_TIME_ELAPSED of the scope, or negative
+struct profile_event
+{
+	const char*	name;
+	int			tid;			// 0: render thread, 1: simulation thread, ...
+	int			depth;			// nesting level within its thread
+	double		start = 0;		// seconds since the profiler's epoch
+	double		cpu = 0;		// seconds
+	double		gpu = -1;		// seconds; negative while pending or without a query
+	GLuint		query = 0;
+};
+
+struct profile_frame
+{
+	int64_t		index = -1;
+	double		start = 0, duration = 0;
+	std::vector<profile_event> events;
+};
+
+//*************************************
+// frame profiler: nestable named CPU scopes, GL_TIME_ELAPSED scopes where supported, a ring
+// buffer of recent frames, a rolling p50/p95/p99 summary, and a Chrome trace export
+// (chrome://tracing or ui.perfetto.dev); scopes cost one branch while disabled
+struct profiler_t
+{
+	enum { FRAMES=240, GPU_LATENCY=3 };	// frames kept; frames before reading back queries
+
+	std::atomic<bool>	enabled{ false };
+	double		report_interval = 2.0;	// seconds between summaries on stdout; 0: never
+
+	std::vector<profile_frame>	frames = std::vector<profile_frame>(FRAMES);
+	int64_t		frame = 0;
+	std::mutex	mutex;				// scopes may close on other threads
+	std::vector<GLuint>	query_pool;
+	bool		gpu_busy = false;	// GL_TIME_ELAPSED queries cannot nest; inner GPU scopes are CPU-only
+	double		last_report = 0;
+
+	static double now(){ static auto epoch=std::chrono::steady_clock::now(); return std::chrono::duration<double>(std::chrono::steady_clock::now()-epoch).count(); }
+	profile_frame& current(){ return frames[size_t(frame%FRAMES)]; }
+
+	void set_enabled( bool b )
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if(b&&!enabled){ for( auto& f : frames ){ release_queries(f); f = profile_frame(); } last_report = now(); current().index = frame; current().start = now(); }
+		enabled = b;
+	}
+
+	// returns a handle for end(); the handle encodes the frame so late closes are dropped
+	int64_t begin( const char* name, int tid, int depth, bool gpu )
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		profile_frame& f = current();
+		profile_event e; e.name=name; e.tid=tid; e.depth=depth; e.start=now();
+		if(gpu&&tid==0&&!gpu_busy&&glGenQueries)
+		{
+			if(query_pool.empty()){ query_pool.resize(16); glGenQueries( 16, query_pool.data() ); }
+			e.query = query_pool.back(); query_pool.pop_back();
+			glBeginQuery( GL_TIME_ELAPSED, e.query ); gpu_busy = true;
+		}
+		f.events.push_back(e);
+		return frame*65536+int64_t(f.events.size()-1);
+	}
+
+	void end( int64_t handle )
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		profile_frame& f = frames[size_t((handle/65536)%FRAMES)];
+		if(f.index!=handle/65536) return;
+		profile_event& e = f.events[size_t(handle%65536)];
+		e.cpu = now()-e.start;
+		if(e.query){ glEndQuery( GL_TIME_ELAPSED ); gpu_busy = false; }
+	}
+
+	// call once per frame on the GL thread, after the swap
+	void frame_end()
+	{
+		if(!enabled) return;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			profile_frame& f = current();
+			f.duration = now()-f.start;
+			resolve( frames[size_t((frame+FRAMES-GPU_LATENCY)%FRAMES)], false );
+			frame++;
+			profile_frame& n = current();
+			resolve( n, true );		// about to be overwritten
+			n.index = frame; n.start = now(); n.duration = 0; n.events.clear();
+		}
+		if(report_interval>0&&now()-last_report>=report_interval){ last_report=now(); print_summary(); }
+	}
+
+	// p50/p95/p99 of the frame times in the ring, and the mean of each scope
+	void print_summary()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::vector<double> t;
+		struct acc { double cpu=0, gpu=0; int n=0, ngpu=0; };
+		std::map<std::string,acc> scopes;
+		for( auto& f : frames )
+		{
+			if(f.index<0||f.duration<=0) continue;
+			t.push_back(f.duration);
+			for( auto& e : f.events ){ acc& a=scopes[e.name]; a.cpu+=e.cpu; a.n++; if(e.gpu>=0){ a.gpu+=e.gpu; a.ngpu++; } }
+		}
+		if(t.empty()) return;
+		std::sort( t.begin(), t.end() );
+		auto pct = [&]( double p ){ return t[std::min(t.size()-1,size_t(p*t.size()))]*1000.0; };
+		printf( "> frame time over %d frames: p50 %.2f ms, p95 %.2f ms, p99 %.2f ms\n", int(t.size()), pct(0.50), pct(0.95), pct(0.99) );
+		for( auto& s : scopes )
+		{
+			printf( ">   %-16s cpu %7.3f ms", s.first.c_str(), s.second.cpu/s.second.n*1000.0 );
+			if(s.second.ngpu) printf( "   gpu %7.3f ms", s.second.gpu/s.second.ngpu*1000.0 );
+			printf( "\n" );
+		}
+	}
+
+	// chrome trace-event format: complete events in microseconds; GPU times go to their own track
+	bool export_trace( const char* path )
+	{
+		FILE* fp = fopen( path, "w" ); if(!fp){ printf( "%s(): unable to open %s\n", __func__, path ); return false; }
+		fprintf( fp, "{\"traceEvents\":[\n" );
+		bool first = true;
+		auto event = [&]( const char* name, int tid, double start, double dur )
+		{
+			fprintf( fp, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", first?"":",\n", name, tid, start*1e6, dur*1e6 );
+			first = false;
+		};
+		std::lock_guard<std::mutex> lock(mutex);
+		for( int64_t k=std::max(int64_t(0),frame-FRAMES+1); k < frame; k++ )
+		{
+			profile_frame& f = frames[size_t(k%FRAMES)]; if(f.index!=k) continue;
+			event( "frame", 0, f.start, f.duration );
+			for( auto& e : f.events )
+			{
+				event( e.name, e.tid, e.start, e.cpu );
+				if(e.gpu>=0) event( e.name, 100+e.tid, e.start, e.gpu );	// GPU time is placed at the CPU start
+			}
+		}
+		fprintf( fp, "\n],\"displayTimeUnit\":\"ms\"}\n" );
+		fclose( fp );
+		return true;
+	}
+
+	void release()
+	{
+		for( auto& f : frames ) release_queries(f);
+		if(!query_pool.empty()) glDeleteQueries( GLsizei(query_pool.size()), query_pool.data() );
+		query_pool.clear();
+	}
+
+protected:
+	// read back finished queries; blocking for a frame about to be overwritten
+	void resolve( profile_frame& f, bool wait )
+	{
+		for( auto& e : f.events )
+		{
+			if(!e.query) continue;
+			GLint available = 0; if(!wait) glGetQueryObjectiv( e.query, GL_QUERY_RESULT_AVAILABLE, &available );
+			if(!wait&&!available) continue;
+			GLuint64 ns = 0; glGetQueryObjectui64v( e.query, GL_QUERY_RESULT, &ns );
+			e.gpu = double(ns)*1e-9;
+			query_pool.push_back(e.query); e.query = 0;
+		}
+	}
+
+	void release_queries( profile_frame& f ){ for( auto& e : f.events ) if(e.query){ glDeleteQueries( 1, &e.query ); e.query=0; } }
+};
+
+inline profiler_t& profiler(){ static profiler_t p; return p; }
+
+//*************************************
+// RAII scope; use PROFILE_SCOPE("name") for CPU time, PROFILE_GPU_SCOPE("name") to add GPU time
+struct profile_scope
+{
+	int64_t handle = -1;
+	profile_scope( const char* name, int tid=0, bool gpu=false )
+	{
+		if(!profiler().enabled) return;
+		handle = profiler().begin( name, tid, depth()++, gpu );
+	}
+	~profile_scope(){ if(handle<0) return; depth()--; profiler().end(handle); }
+	static int& depth(){ thread_local int d=0; return d; }
+};
+
+#ifndef NO_PROFILER
+	#define PROFILE_CONCAT_(a,b)		a##b
+	#define PROFILE_CONCAT(a,b)			PROFILE_CONCAT_(a,b)
+	#define PROFILE_SCOPE(name)			profile_scope PROFILE_CONCAT(_profile_scope_,__LINE__)(name)
+	#define PROFILE_THREAD_SCOPE(name,tid)	profile_scope PROFILE_CONCAT(_profile_scope_,__LINE__)(name,tid)
+	#define PROFILE_GPU_SCOPE(name)		profile_scope PROFILE_CONCAT(_profile_scope_,__LINE__)(name,0,true)
+#else
+	#define PROFILE_SCOPE(name)
+	#define PROFILE_THREAD_SCOPE(name,tid)
+	#define PROFILE_GPU_SCOPE(name)
+#endif
+
+#endif // __PROFILER_H__
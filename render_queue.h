@@ -0,0 +1,108 @@
+#pragma once
+#ifndef __RENDER_QUEUE_H__
+#define __RENDER_QUEUE_H__
+
+#include "cgut.h"
+#include "texture.h"
+#include <stdint.h>
+#include <algorithm>
+#include <unordered_map>
+
+//*************************************
+// a draw call with the state it needs
+struct draw_item_t
+{
+	GLuint		program = 0;
+	GLuint		vertex_array = 0;
+	GLsizei		count = 0;					// vertices of glDrawArrays()
+	GLuint		textures[2] = { 0, 0 };		// texture units 0 and 1; 0: don't care
+	bool		blend = false;				// transparent items are drawn last, back-to-front
+	float		depth = 0;					// view-space distance of the item
+	mat4		model_matrix;
+	vec4		params;						// program-specific per-item values
+};
+
+//*************************************
+// per-frame counters of the queue
+struct render_stats_t
+{
+	int		draws = 0;
+	int		programs = 0;		// glUseProgram
+	int		vertex_arrays = 0;	// glBindVertexArray
+	int		textures = 0;		// glBindTexture
+	int		blends = 0;			// glEnable/glDisable(GL_BLEND)
+	int		state_changes() const { return programs+vertex_arrays+textures+blends; }
+};
+
+//*************************************
+// render queue: items are sorted by a 64-bit key, and each is submitted exactly once;
+// state is bound only when it differs from the previous item
+//   opaque:      [63]=0 | bucket(4) | program(6) | vertex array(6) | texture0(10) | texture1(10) | depth(16)
+//   transparent: [63]=1 | depth(16, back-to-front) | program(6) | vertex array(6) | texture0(10)
+// opaque items are drawn front-to-back by coarse depth buckets, which grow logarithmically from
+// the eye, and grouped by state within a bucket; exact depth orders items of the same state
+// GL names are packed as dense per-queue indices (name 0 stays 0); names beyond the width
+// of a field share its last index, which costs state changes but never correctness
+struct render_queue
+{
+	std::vector<draw_item_t>					items;
+	std::vector<std::pair<uint64_t,uint32_t>>	order;		// (key, item index)
+	std::unordered_map<GLuint,uint64_t>			index[3];	// GL name -> dense index of programs, vertex arrays, textures
+	float			far_depth = 1000.0f;	// depth mapped to the last quantization step
+	render_stats_t	stats;					// stats of the last submit()
+
+	void clear(){ items.clear(); }
+	void push( const draw_item_t& item ){ items.push_back(item); }
+
+	uint64_t dense( int kind, GLuint name, uint64_t mask )
+	{
+		if(!name) return 0;
+		auto it = index[kind].emplace( name, index[kind].size()+1 ).first;
+		return std::min( it->second, mask );
+	}
+
+	uint64_t key( const draw_item_t& item )
+	{
+		float z = std::min(std::max(item.depth/far_depth,0.0f),1.0f);
+		uint64_t d = uint64_t(z*65535.0f);
+		uint64_t p=dense(0,item.program,0x3f), v=dense(1,item.vertex_array,0x3f), t0=dense(2,item.textures[0],0x3ff), t1=dense(2,item.textures[1],0x3ff);
+		if(!item.blend){ uint64_t b=std::min(uint64_t(2.0f*log2f(1.0f+255.0f*z)),uint64_t(15)); return (b<<48)|(p<<42)|(v<<36)|(t0<<26)|(t1<<16)|d; }
+		return (uint64_t(1)<<63)|((65535-d)<<32)|(p<<26)|(v<<20)|(t0<<10);
+	}
+
+	void sort()
+	{
+		order.resize(items.size());
+		for( auto& i : index ) i.clear();
+		for( size_t k=0; k < items.size(); k++ ) order[k] = std::make_pair( key(items[k]), uint32_t(k) );
+		std::sort( order.begin(), order.end() );
+	}
+
+	// sort, then draw every item once; set_uniforms(item) uploads the per-item uniforms
+	template <class F> void submit( F set_uniforms )
+	{
+		sort();
+		stats = render_stats_t();
+		GLuint program=0, vertex_array=0, textures[2]={0,0}; int blend=-1;
+		for( auto& o : order )
+		{
+			const draw_item_t& item = items[o.second];
+			if(item.program!=program){ glUseProgram( program=item.program ); stats.programs++; }
+			if(item.vertex_array!=vertex_array){ glBindVertexArray( vertex_array=item.vertex_array ); stats.vertex_arrays++; }
+			for( GLuint unit=0; unit < 2; unit++ )
+			{
+				if(!item.textures[unit]||item.textures[unit]==textures[unit]) continue;
+				bind_texture( unit, GL_TEXTURE_2D, textures[unit]=item.textures[unit] );
+				stats.textures++;
+			}
+			if(int(item.blend)!=blend){ if((blend=int(item.blend))) glEnable( GL_BLEND ); else glDisable( GL_BLEND ); stats.blends++; }
+			set_uniforms( item );
+			glDrawArrays( GL_TRIANGLES, 0, item.count );
+			stats.draws++;
+		}
+		if(blend==1) glDisable( GL_BLEND );
+		glActiveTexture( GL_TEXTURE0 );
+	}
+};
+
+#endif // __RENDER_QUEUE_H__
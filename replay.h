@@ -0,0 +1,89 @@
+#pragma once
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+//*************************************
+// input recording: a header, then fixed-size records; events are tagged with the frame
+// whose update() they precede, and every frame ends with a FRAME record of its clock
+enum input_type { INPUT_KEY=1, INPUT_BUTTON=2, INPUT_CURSOR=3, INPUT_RESIZE=4, INPUT_FRAME=5 };
+
+struct input_header
+{
+	char		magic[4] = { 'I','N','P','1' };
+	int32_t		width = 0, height = 0;	// window size when recording started
+	double		step = 0;				// simulation seconds per frame
+};
+
+struct input_event
+{
+	uint32_t	frame = 0;
+	uint32_t	type = 0;
+	int32_t		i[4] = { 0, 0, 0, 0 };	// key: key, scancode, action, mods; button: button, action, mods; resize: width, height
+	double		x = 0, y = 0;			// cursor position; FRAME: x is the simulation clock
+};
+
+struct input_recorder
+{
+	FILE*		fp = nullptr;
+	uint32_t	frame = 0;
+	int			events = 0;
+
+	bool open( const char* path, int width, int height, double step )
+	{
+		if(!(fp=fopen( path, "wb" ))){ printf( "%s(): unable to open %s\n", __func__, path ); return false; }
+		input_header h; h.width=width; h.height=height; h.step=step;
+		fwrite( &h, sizeof(h), 1, fp );
+		return true;
+	}
+	operator bool() const { return fp!=nullptr; }
+
+	void key( int key, int scancode, int action, int mods ){ input_event e; e.type=INPUT_KEY; e.i[0]=key; e.i[1]=scancode; e.i[2]=action; e.i[3]=mods; write(e); }
+	void button( int button, int action, int mods, double x, double y ){ input_event e; e.type=INPUT_BUTTON; e.i[0]=button; e.i[1]=action; e.i[2]=mods; e.x=x; e.y=y; write(e); }
+	void cursor( double x, double y ){ input_event e; e.type=INPUT_CURSOR; e.x=x; e.y=y; write(e); }
+	void resize( int width, int height ){ input_event e; e.type=INPUT_RESIZE; e.i[0]=width; e.i[1]=height; write(e); }
+	void frame_end( double clock ){ input_event e; e.type=INPUT_FRAME; e.x=clock; write(e); frame++; }
+
+	void close(){ if(fp) fclose(fp); fp=nullptr; }
+
+protected:
+	void write( input_event& e ){ if(!fp) return; e.frame=frame; fwrite( &e, sizeof(e), 1, fp ); events++; }
+};
+
+//*************************************
+// replays a recording frame by frame; dispatch(frame, f) calls f(event) for the frame's input
+struct input_player
+{
+	input_header				header;
+	std::vector<input_event>	events;
+	std::vector<double>			clocks;		// simulation clock of each frame
+	size_t						cursor = 0;
+
+	bool load( const char* path )
+	{
+		FILE* fp = fopen( path, "rb" ); if(!fp){ printf( "%s(): unable to open %s\n", __func__, path ); return false; }
+		bool ok = fread( &header, sizeof(header), 1, fp )==1 && memcmp(header.magic,"INP1",4)==0;
+		input_event e;
+		while(ok&&fread( &e, sizeof(e), 1, fp )==1){ if(e.type==INPUT_FRAME) clocks.push_back(e.x); else events.push_back(e); }
+		fclose( fp );
+		if(!ok) printf( "%s(): %s is not an input recording\n", __func__, path );
+		return ok;
+	}
+	int frames() const { return int(clocks.size()); }
+
+	template <class F> void dispatch( uint32_t frame, F f ){ while(cursor<events.size()&&events[cursor].frame<=frame) f(events[cursor++]); }
+};
+
+// FNV-1a over the pixels, to compare frames of two builds without storing them
+inline uint64_t image_checksum( const std::vector<unsigned char>& pixels )
+{
+	uint64_t h = 14695981039346656037ull;
+	for( unsigned char c : pixels ){ h ^= c; h *= 1099511628211ull; }
+	return h;
+}
+
+#endif // __REPLAY_H__
@@ -0,0 +1,51 @@
+#pragma once
+#ifndef __SCENE_H__
+#define __SCENE_H__
+
+#include "cgmath.h"
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+//*************************************
+// flat transform hierarchy: nodes are stored in arrays with parents ahead of their
+// children, so world matrices are produced in one linear pass; only nodes whose local
+// matrix changed, and their descendants, are recomputed
+struct scene_graph
+{
+	std::vector<int>		parent;		// -1 for roots
+	std::vector<mat4>		local;		// relative to the parent
+	std::vector<mat4>		world;
+	std::vector<uint8_t>	dirty;		// local changed since the last update()
+	std::vector<uint8_t>	updated;	// scratch of update(): 1 when recomputed
+	int						recomputed = 0;	// world matrices recomputed by the last update()
+
+	void clear(){ parent.clear(); local.clear(); world.clear(); dirty.clear(); updated.clear(); }
+	int size() const { return int(parent.size()); }
+
+	// the parent must already exist, which keeps the arrays in topological order
+	int add( int parent_node, const mat4& m=mat4() )
+	{
+		parent.push_back(parent_node); local.push_back(m); world.push_back(m);
+		dirty.push_back(1); updated.push_back(0);
+		return int(parent.size())-1;
+	}
+
+	void set_local( int node, const mat4& m ){ if(memcmp(&local[node],&m,sizeof(mat4))!=0){ local[node]=m; dirty[node]=1; } }
+
+	void update()
+	{
+		recomputed = 0;
+		for( int k=0, n=size(); k < n; k++ )
+		{
+			int p = parent[k];
+			if(p>=0&&updated[p]) dirty[k]=1;	// inherit the parent's change
+			updated[k] = dirty[k];
+			if(!dirty[k]) continue;
+			world[k] = p<0 ? local[k] : world[p]*local[k];
+			dirty[k] = 0; recomputed++;
+		}
+	}
+};
+
+#endif // __SCENE_H__
@@ -0,0 +1,188 @@
+#pragma once
+#ifndef __SHADER_H__
+#define __SHADER_H__
+
+#include "cgut.h"
+#include "uniform.h"
+#include <functional>
+#include <map>
+#include <stdint.h>
+
+//*************************************
+// insert "#define NAME" lines right after the #version line (GLSL requires #version first)
+inline std::string inject_defines( const char* source, const std::string& defines )
+{
+	std::string s(source);
+	size_t v = s.find("#version"); if(v==std::string::npos) return defines+s;
+	size_t eol = s.find('\n',v); if(eol==std::string::npos){ s+='\n'; eol=s.size()-1; }
+	return s.substr(0,eol+1)+defines+s.substr(eol+1);
+}
+
+//*************************************
+// whole text file; empty when unreadable
+inline std::string read_text( const char* path )
+{
+	FILE* fp = fopen( path, "rb" ); if(!fp) return std::string();
+	std::string s; char buf[4096]; size_t n;
+	while((n=fread(buf,1,sizeof(buf),fp))>0) s.append(buf,n);
+	fclose( fp );
+	return s;
+}
+
+// compile and link; retrievable asks the driver to keep the binary for glGetProgramBinary()
+inline GLuint compile_program( const char* vert, const char* frag, bool retrievable )
+{
+	auto compile = []( GLenum type, const char* source ) -> GLuint
+	{
+		GLuint shader = glCreateShader( type );
+		glShaderSource( shader, 1, &source, nullptr );
+		glCompileShader( shader );
+		GLint ok=0; glGetShaderiv( shader, GL_COMPILE_STATUS, &ok ); if(ok) return shader;
+		GLint n=0; glGetShaderiv( shader, GL_INFO_LOG_LENGTH, &n ); std::vector<char> log(size_t(n)+1);
+		glGetShaderInfoLog( shader, n, nullptr, log.data() );
+		printf( "[%s shader] %s\n", type==GL_VERTEX_SHADER?"vertex":"fragment", log.data() );
+		glDeleteShader( shader ); return 0;
+	};
+	GLuint vs=compile( GL_VERTEX_SHADER, vert ); if(!vs) return 0;
+	GLuint fs=compile( GL_FRAGMENT_SHADER, frag ); if(!fs){ glDeleteShader(vs); return 0; }
+	GLuint program = glCreateProgram();
+	glAttachShader( program, vs ); glAttachShader( program, fs );
+	if(retrievable&&glProgramParameteri) glProgramParameteri( program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
+	glLinkProgram( program );
+	glDetachShader( program, vs ); glDetachShader( program, fs );
+	glDeleteShader( vs ); glDeleteShader( fs );
+	GLint ok=0; glGetProgramiv( program, GL_LINK_STATUS, &ok ); if(ok) return program;
+	GLint n=0; glGetProgramiv( program, GL_INFO_LOG_LENGTH, &n ); std::vector<char> log(size_t(n)+1);
+	glGetProgramInfoLog( program, n, nullptr, log.data() );
+	printf( "[program] %s\n", log.data() );
+	glDeleteProgram( program ); return 0;
+}
+
+//*************************************
+// program binary cache: linked programs are saved with glGetProgramBinary() under a key
+// hashed from the sources (defines included) and the driver strings, and reloaded with
+// glProgramBinary() by later runs; any mismatch or rejected binary falls back to compiling
+struct program_cache
+{
+	struct header { char magic[4]; uint32_t format, length; uint64_t key; };
+
+	std::string	dir = "../bin/shaders/";	// cache files are <dir>cache-<key>.bin
+	bool		enabled = true;
+	int			hits = 0, misses = 0;
+	double		time = 0;					// seconds spent creating programs
+
+	bool supported()
+	{
+		if(!glGetProgramBinary||!glProgramBinary) return false;
+		GLint n=0; glGetIntegerv( GL_NUM_PROGRAM_BINARY_FORMATS, &n ); return n>0;
+	}
+
+	uint64_t key( const std::string& vert, const std::string& frag )
+	{
+		uint64_t h = 14695981039346656037ull;
+		auto mix = [&]( const char* s, size_t n ){ for( size_t k=0; k < n; k++ ){ h ^= uint8_t(s[k]); h *= 1099511628211ull; } h ^= 0xff; h *= 1099511628211ull; };
+		mix( vert.data(), vert.size() ); mix( frag.data(), frag.size() );
+		for( GLenum e : { GL_VENDOR, GL_RENDERER, GL_VERSION } ){ const char* s=(const char*)glGetString(e); if(s) mix( s, strlen(s) ); }
+		return h;
+	}
+
+	GLuint create( const std::string& vert, const std::string& frag )
+	{
+		double t0 = glfwGetTime();
+		bool use = enabled&&supported();
+		uint64_t k = use ? key(vert,frag) : 0;
+		char path[1024]; snprintf( path, sizeof(path), "%scache-%016llx.bin", dir.c_str(), (unsigned long long) k );
+
+		GLuint program = use ? load( path, k ) : 0;
+		if(program) hits++;
+		else
+		{
+			misses++;
+			program = compile_program( vert.c_str(), frag.c_str(), use );
+			if(program&&use) save( path, k, program );
+		}
+		time += glfwGetTime()-t0;
+		return program;
+	}
+
+	GLuint create_from_files( const char* vert_path, const char* frag_path )
+	{
+		std::string vert=read_text(vert_path), frag=read_text(frag_path);
+		if(vert.empty()||frag.empty()){ printf( "%s(): unable to read %s or %s\n", __func__, vert_path, frag_path ); return 0; }
+		return create( vert, frag );
+	}
+
+protected:
+	GLuint load( const char* path, uint64_t k )
+	{
+		FILE* fp = fopen( path, "rb" ); if(!fp) return 0;
+		header h; std::vector<char> data;
+		bool ok = fread( &h, sizeof(h), 1, fp )==1 && memcmp(h.magic,"PRG1",4)==0 && h.key==k;
+		if(ok){ data.resize(h.length); ok = fread( data.data(), 1, data.size(), fp )==data.size(); }
+		fclose( fp ); if(!ok) return 0;
+
+		GLuint program = glCreateProgram();
+		glProgramBinary( program, h.format, data.data(), GLsizei(data.size()) );
+		GLint linked=0; glGetProgramiv( program, GL_LINK_STATUS, &linked );
+		if(!linked){ glDeleteProgram( program ); return 0; }	// e.g., a driver update; recompiled by the caller
+		return program;
+	}
+
+	void save( const char* path, uint64_t k, GLuint program )
+	{
+		GLint length=0; glGetProgramiv( program, GL_PROGRAM_BINARY_LENGTH, &length ); if(length<=0) return;
+		std::vector<char> data(static_cast<size_t>(length)); GLenum format=0;
+		glGetProgramBinary( program, length, nullptr, &format, data.data() );
+		FILE* fp = fopen( path, "wb" ); if(!fp) return;
+		header h; memset( &h, 0, sizeof(h) );	// no stray padding bytes in the file
+		memcpy( h.magic, "PRG1", 4 ); h.format=format; h.length=uint32_t(length); h.key=k;
+		fwrite( &h, sizeof(h), 1, fp ); fwrite( data.data(), 1, data.size(), fp );
+		fclose( fp );
+	}
+};
+
+inline program_cache& program_binaries(){ static program_cache c; return c; }
+
+//*************************************
+// shader permutations: one source with #ifdef blocks, compiled per feature mask on first use
+// and cached; U is a struct of uniform_t resolved for each variant
+template <class U> struct shader_variants
+{
+	struct variant { GLuint program = 0; U u; uint32_t mask = 0; };
+
+	const char*			vert_source;
+	const char*			frag_source;
+	const char* const*	features;		// feature names; bit k of a mask defines features[k]
+	int					feature_count;
+	std::function<void(GLuint)>	on_link;	// e.g., attach uniform blocks
+	std::map<uint32_t,variant>	cache;
+	double				compile_time = 0;	// seconds spent compiling all variants
+
+	shader_variants( const char* vert, const char* frag, const char* const* features, int count ):vert_source(vert),frag_source(frag),features(features),feature_count(count){}
+
+	std::string defines( uint32_t mask ) const
+	{
+		std::string d;
+		for( int k=0; k < feature_count; k++ ) if(mask&(1u<<k)) d += std::string("#define ")+features[k]+"\n";
+		return d;
+	}
+
+	// the variant of a mask, compiled on demand; program is 0 when it failed to build
+	variant& get( uint32_t mask )
+	{
+		auto it = cache.find(mask); if(it!=cache.end()) return it->second;
+		variant& v = cache[mask]; v.mask = mask;
+		double t0 = glfwGetTime();
+		std::string d = defines(mask);
+		v.program = program_binaries().create( inject_defines(vert_source,d), inject_defines(frag_source,d) );
+		compile_time += glfwGetTime()-t0;
+		if(!v.program){ printf( "%s(): failed to build variant 0x%x\n", __func__, mask ); return v; }
+		resolve_uniforms( v.program, v.u );
+		if(on_link) on_link( v.program );
+		return v;
+	}
+
+	void release(){ for( auto& c : cache ) if(c.second.program) glDeleteProgram( c.second.program ); cache.clear(); }
+};
+
+#endif // __SHADER_H__
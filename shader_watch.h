@@ -0,0 +1,170 @@
+#pragma once
+#ifndef __SHADER_WATCH_H__
+#define __SHADER_WATCH_H__
+
+#include "shader.h"
+#include <sys/stat.h>
+#ifdef __linux__
+	#include <sys/inotify.h>
+	#include <unistd.h>
+#endif
+
+#ifndef GL_COMPLETION_STATUS_KHR
+	#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+//*************************************
+// hot shader reload: the shader files of each watched program are observed (inotify on linux,
+// modification times elsewhere); a change starts a rebuild whose compile/link runs across
+// frames, and the old program stays in use until the new one links; poll() swaps at the
+// frame boundary, and on_swap re-resolves uniforms and re-attaches blocks
+struct shader_watch
+{
+	struct watched
+	{
+		std::string	vert_path, frag_path;
+		GLuint*		program;
+		std::function<void(GLuint)>	on_swap;
+		time_t		mtime[2] = { 0, 0 };
+		double		changed = -1;		// time of the last file event; negative: none pending
+		GLuint		shaders[2] = { 0, 0 }, pending = 0;
+		double		start = 0;
+		int			polls = 0;			// frames since the build was issued
+	};
+
+	std::vector<watched>	programs;
+	double	settle = 0.1;				// seconds without file events before rebuilding (editors write in bursts)
+	double	last_scan = 0;
+	bool	parallel = false;			// KHR/ARB_parallel_shader_compile: poll completion without blocking
+	int		fd = -1;					// inotify
+
+	void add( const char* vert_path, const char* frag_path, GLuint* program, std::function<void(GLuint)> on_swap )
+	{
+		if(programs.empty()) init();
+		watched w; w.vert_path=vert_path; w.frag_path=frag_path; w.program=program; w.on_swap=on_swap;
+		w.mtime[0]=modified(vert_path); w.mtime[1]=modified(frag_path);
+		programs.push_back(w);
+#ifdef __linux__
+		for( auto* p : { vert_path, frag_path } ) if(fd>=0) inotify_add_watch( fd, directory(p).c_str(), IN_CLOSE_WRITE|IN_MOVED_TO|IN_CREATE );
+#endif
+	}
+
+	// call once per frame, before update()
+	void poll()
+	{
+		double now = glfwGetTime();
+		detect( now );
+		for( auto& w : programs )
+		{
+			if(w.pending){ finish(w); continue; }
+			if(w.changed>=0&&now-w.changed>=settle){ w.changed=-1; begin(w); }
+		}
+	}
+
+	void release()
+	{
+		for( auto& w : programs ) if(w.pending) discard(w);
+		programs.clear();
+#ifdef __linux__
+		if(fd>=0){ close(fd); fd = -1; }
+#endif
+	}
+
+protected:
+	void init()
+	{
+		GLint n=0; glGetIntegerv( GL_NUM_EXTENSIONS, &n );
+		for( GLint k=0; k < n; k++ ){ const char* e=(const char*)glGetStringi( GL_EXTENSIONS, GLuint(k) ); if(e&&(strcmp(e,"GL_KHR_parallel_shader_compile")==0||strcmp(e,"GL_ARB_parallel_shader_compile")==0)) parallel=true; }
+#ifdef __linux__
+		fd = inotify_init1( IN_NONBLOCK );
+#endif
+	}
+
+	static std::string directory( const char* path ){ std::string s(path); size_t k=s.find_last_of("/\\"); return k==std::string::npos ? std::string(".") : s.substr(0,k); }
+	static std::string filename( const std::string& path ){ size_t k=path.find_last_of("/\\"); return k==std::string::npos ? path : path.substr(k+1); }
+	static time_t modified( const std::string& path ){ struct stat st; return stat( path.c_str(), &st )==0 ? st.st_mtime : 0; }
+
+	void detect( double now )
+	{
+#ifdef __linux__
+		if(fd>=0)
+		{
+			alignas(inotify_event) char buf[4096]; ssize_t n;
+			while((n=read( fd, buf, sizeof(buf) ))>0)
+			{
+				for( char* p=buf; p < buf+n; p += sizeof(inotify_event)+((inotify_event*)p)->len )
+				{
+					inotify_event* e = (inotify_event*) p; if(!e->len) continue;
+					for( auto& w : programs ) if(filename(w.vert_path)==e->name||filename(w.frag_path)==e->name) w.changed = now;
+				}
+			}
+			return;
+		}
+#endif
+		if(now-last_scan<0.5) return;
+		last_scan = now;
+		for( auto& w : programs )
+		{
+			time_t m[2] = { modified(w.vert_path), modified(w.frag_path) };
+			if(m[0]!=w.mtime[0]||m[1]!=w.mtime[1]){ w.mtime[0]=m[0]; w.mtime[1]=m[1]; w.changed=now; }
+		}
+	}
+
+	// issue compile and link without querying their status, so the driver may work in the background
+	void begin( watched& w )
+	{
+		std::string src[2] = { read_text( w.vert_path.c_str() ), read_text( w.frag_path.c_str() ) };
+		if(src[0].empty()||src[1].empty()){ printf( "> reload: unable to read %s or %s\n", w.vert_path.c_str(), w.frag_path.c_str() ); return; }
+		w.start = glfwGetTime(); w.polls = 0;
+		GLenum types[2] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+		w.pending = glCreateProgram();
+		for( int k=0; k < 2; k++ )
+		{
+			const char* s = src[k].c_str();
+			w.shaders[k] = glCreateShader( types[k] );
+			glShaderSource( w.shaders[k], 1, &s, nullptr );
+			glCompileShader( w.shaders[k] );
+			glAttachShader( w.pending, w.shaders[k] );
+		}
+		glLinkProgram( w.pending );
+	}
+
+	// from the next frame on: swap when linked, or report and keep the old program
+	void finish( watched& w )
+	{
+		if(++w.polls<2) return;
+		if(parallel){ GLint done=0; glGetProgramiv( w.pending, GL_COMPLETION_STATUS_KHR, &done ); if(!done) return; }
+		GLint linked=0; glGetProgramiv( w.pending, GL_LINK_STATUS, &linked );
+		double ms = (glfwGetTime()-w.start)*1000.0;
+		if(!linked)
+		{
+			for( GLuint s : w.shaders ){ GLint ok=0; glGetShaderiv( s, GL_COMPILE_STATUS, &ok ); if(!ok) print_log( s, true ); }
+			print_log( w.pending, false );
+			printf( "> reload: %s + %s failed after %.1f ms; keeping the previous program\n", filename(w.vert_path).c_str(), filename(w.frag_path).c_str(), ms );
+			discard(w); return;
+		}
+		for( GLuint& s : w.shaders ){ glDetachShader( w.pending, s ); glDeleteShader( s ); s=0; }
+		GLuint old = *w.program;
+		*w.program = w.pending; w.pending = 0;
+		if(w.on_swap) w.on_swap( *w.program );
+		if(old) glDeleteProgram( old );
+		printf( "> reload: %s + %s compiled and linked in %.1f ms (%d frames)\n", filename(w.vert_path).c_str(), filename(w.frag_path).c_str(), ms, w.polls );
+	}
+
+	void discard( watched& w )
+	{
+		for( GLuint& s : w.shaders ){ if(s) glDeleteShader( s ); s=0; }
+		if(w.pending){ glDeleteProgram( w.pending ); w.pending = 0; }
+	}
+
+	static void print_log( GLuint object, bool shader )
+	{
+		GLint n=0; if(shader) glGetShaderiv( object, GL_INFO_LOG_LENGTH, &n ); else glGetProgramiv( object, GL_INFO_LOG_LENGTH, &n );
+		if(n<=1) return;
+		std::vector<char> log(size_t(n)+1);
+		if(shader) glGetShaderInfoLog( object, n, nullptr, log.data() ); else glGetProgramInfoLog( object, n, nullptr, log.data() );
+		printf( "%s\n", log.data() );
+	}
+};
+
+#endif // __SHADER_WATCH_H__
@@ -0,0 +1,41 @@
+#pragma once
+#ifndef __SIM_CLOCK_H__
+#define __SIM_CLOCK_H__
+
+#include <algorithm>
+#include <atomic>
+#include <stdint.h>
+
+//*************************************
+// simulation clock: sampled once per step by tick(), and every body of the step is evaluated
+// at the same time; variable steps follow the wall clock, fixed steps advance by a constant
+// so that results do not depend on frame rate; scale, pause and mode may be changed from
+// another thread than the one ticking
+struct sim_clock
+{
+	std::atomic<double>	scale{ 1.0 };		// simulation seconds per wall-clock second
+	std::atomic<bool>	paused{ false };
+	std::atomic<double>	fixed_step{ 0.0 };	// wall-clock seconds per tick; 0: variable step
+	double	max_delta = 0.25;				// longest variable step, e.g., after a stall or a breakpoint
+
+	double	time = 0;		// simulation seconds
+	double	delta = 0;		// simulation seconds advanced by the last tick
+	double	wall = -1;		// wall clock of the last tick; negative before the first
+	int64_t	ticks = 0;
+
+	// advance once; now is the wall clock of the step (or the lockstep clock)
+	double tick( double now )
+	{
+		double step = fixed_step.load();
+		double dt = step>0 ? step : wall<0 ? 0 : std::min(max_delta,std::max(0.0,now-wall));
+		wall = now;
+		delta = paused ? 0 : dt*scale;
+		time += delta;
+		ticks++;
+		return time;
+	}
+
+	void reset(){ time = delta = 0; wall = -1; ticks = 0; }
+};
+
+#endif // __SIM_CLOCK_H__
@@ -0,0 +1,60 @@
+#pragma once
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include "cgmath.h"
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+//*************************************
+// lock-free triple buffer between one producer and one consumer thread: the producer
+// fills write_buffer() and publishes it; the consumer acquires the latest published
+// slot, and neither side ever waits for the other
+template <class T> struct triple_buffer
+{
+	enum { FRESH=4 };		// set in middle when it holds a slot the consumer has not taken
+
+	T					slots[3];
+	std::atomic<int>	middle{1};
+	int					back = 0;		// producer's slot
+	int					front = 2;		// consumer's slot
+
+	T& write_buffer(){ return slots[back]; }
+	void publish(){ back = middle.exchange( back|FRESH, std::memory_order_acq_rel )&3; }
+
+	// true when a newer slot was taken; read_buffer() is stable until the next acquire()
+	bool acquire()
+	{
+		if(!(middle.load(std::memory_order_acquire)&FRESH)) return false;
+		front = middle.exchange( front, std::memory_order_acq_rel )&3;
+		return true;
+	}
+	const T& read_buffer() const { return slots[front]; }
+};
+
+//*************************************
+// immutable result of one simulation step
+struct scene_snapshot
+{
+	double				time = 0;		// wall (or lockstep) clock of the step; snapshots are blended on it
+	double				clock = 0;		// simulation clock of the step, which may be scaled or paused
+	std::vector<mat4>	world;			// world matrices of every scene node
+	int					recomputed = 0;	// world matrices recomputed by the step
+	double				cost = 0;		// CPU time of the step
+};
+
+// blend two snapshots element-wise; steps are short, so a linear blend of the matrices
+// stays close to the true in-between rotation; returns the simulation clock blended alike
+inline double interpolate( const scene_snapshot& a, const scene_snapshot& b, double time, std::vector<mat4>& out )
+{
+	double span = b.time-a.time;
+	float t = span>0 ? float(std::min(std::max((time-a.time)/span,0.0),1.0)) : 1.0f;
+	out.resize(b.world.size());
+	if(a.world.size()!=b.world.size()||t>=1.0f){ out = b.world; return b.clock; }
+	for( size_t k=0; k < out.size(); k++ )
+		for( int j=0; j < 16; j++ ) out[k].a[j] = a.world[k].a[j]+(b.world[k].a[j]-a.world[k].a[j])*t;
+	return a.clock+(b.clock-a.clock)*t;
+}
+
+#endif // __SNAPSHOT_H__
@@ -0,0 +1,317 @@
+#pragma once
+#ifndef __STARFIELD_H__
+#define __STARFIELD_H__
+
+#include "cgut.h"
+#include "uniform.h"
+#include "shader.h"
+#include "frustum.h"
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+//*************************************
+// stars at infinity as point sprites: only the rotation of the view applies, and sprites are
+// drawn on the far plane; size and brightness grow with how much brighter than the limit a
+// star is, and the color follows its B-V index
+static const char* star_vert_source = R"(
+#version 330
+layout(location=0) in vec2 direction;	// octahedral encoding in [0,1]
+layout(location=1) in float magnitude;	// thousandths of a magnitude
+layout(location=2) in float color;		// B-V index, mapped from [-0.4,2] to [0,1]
+
+layout(std140, row_major) uniform Camera { mat4 view_matrix; mat4 projection_matrix; };
+uniform float limit;		// faintest magnitude drawn
+uniform float point_scale;	// pixels per unit of sprite size
+
+out vec3 star_color;
+
+void main()
+{
+	vec2 e = direction*2.0-1.0;
+	vec3 d = vec3(e,1.0-abs(e.x)-abs(e.y));
+	if(d.z<0.0) d.xy = (1.0-abs(d.yx))*vec2(d.x>=0.0?1.0:-1.0,d.y>=0.0?1.0:-1.0);
+	gl_Position = (projection_matrix*vec4(mat3(view_matrix)*normalize(d),0.0)).xyww;
+
+	float excess = limit-magnitude*0.001;	// magnitudes brighter than the limit
+	gl_PointSize = clamp(1.0+0.5*excess,1.0,7.0)*point_scale;
+	float bv = color*2.4-0.4;
+	vec3 c = mix(vec3(0.65,0.75,1.0),vec3(1.0),smoothstep(-0.4,0.3,bv));
+	c = mix(c,vec3(1.0,0.82,0.6),smoothstep(0.3,1.2,bv));
+	c = mix(c,vec3(1.0,0.62,0.4),smoothstep(1.2,2.0,bv));
+	star_color = c*clamp(0.1*pow(10.0,0.2*excess),0.0,1.0);	// square root of the flux relative to the limit
+}
+)";
+
+static const char* star_frag_source = R"(
+#version 330
+in vec3 star_color;
+out vec4 fragColor;
+
+void main()
+{
+	vec2 p = gl_PointCoord*2.0-1.0;
+	float r2 = dot(p,p); if(r2>1.0) discard;
+	fragColor = vec4(star_color*exp(-4.0*r2),1);
+}
+)";
+
+//*************************************
+// compact star record: 8 bytes, read directly as vertex attributes
+struct star_t
+{
+	uint16_t	dir[2];		// octahedral encoding of the direction
+	int16_t		mag;		// visual magnitude in thousandths
+	uint8_t		color;		// B-V index, mapped from [-0.4,2] to [0,255]
+	uint8_t		pad;
+};
+
+// catalogue file: a header, the cell table, then the stars sorted by cell, and by magnitude within a cell
+struct star_header
+{
+	char		magic[4] = { 'S','T','R','1' };
+	int32_t		cells_per_face = 0;
+	uint32_t	count = 0;
+	uint32_t	pad = 0;
+};
+
+struct star_cell { uint32_t first = 0, count = 0; };
+
+//*************************************
+// star catalogue with a spatial index of directions: each face of a cube is divided into
+// N*N cells (equal-angle, so cells are of similar size on the sphere), and the stars of a
+// cell are contiguous and sorted by magnitude; a frame tests the cells' bounding cones
+// against the frustum, takes the prefix of each visible cell down to the limit magnitude,
+// and submits every range with one glMultiDrawArrays
+struct starfield
+{
+	enum { FACES=6 };
+	struct uniforms { uniform_t limit = "limit", point_scale = "point_scale"; };
+	struct stats_t { int cells = 0, ranges = 0; int64_t stars = 0; };
+
+	int			cells_per_face = 32;
+	float		limit = 9.0f;			// faintest magnitude drawn
+	float		point_scale = 1.0f;
+	bool		enabled = true;
+
+	std::vector<star_t>		stars;		// sorted by cell, then by magnitude
+	std::vector<star_cell>	cells;		// FACES*N*N
+	std::vector<uint32_t>	bright;		// per cell: stars at or above the limit
+	cull_set				bounds;		// bounding cones of the cells, as spheres on the unit sphere
+	float					counted_limit = NAN;	// limit of bright[]
+	std::vector<GLint>		firsts;
+	std::vector<GLsizei>	counts;
+	stats_t					stats;		// of the last draw()
+
+	GLuint		program = 0, vao = 0, buffer = 0;
+	uniforms	u;
+
+	// random catalogue: magnitudes from -1.5 with the count growing by 10^0.5 per magnitude
+	// (9000 stars brighter than 6.5), concentrated towards a galactic plane tilted by 60 degrees
+	void generate( uint32_t count, uint32_t seed=1 )
+	{
+		std::mt19937 rng(seed);
+		std::uniform_real_distribution<double> uniform(0.0,1.0);
+		std::normal_distribution<double> bv(0.6,0.35);
+		double m_min = -1.5, m_max = 6.5+2.0*log10(std::max(count,1u)/9000.0), faint = pow(10.0,-0.5*(m_max-m_min));
+		double ct = cos(PI/3), st = sin(PI/3);
+		std::vector<star_t> v(count);
+		std::vector<vec3> dirs(count);
+		for( uint32_t k=0; k < count; k++ )
+		{
+			double l = 2*PI*uniform(rng), sb;
+			if(uniform(rng)<0.6){ double x = -0.12*log(1.0-uniform(rng)); sb = sin(std::min(x,PI/2.0)*(uniform(rng)<0.5?-1:1)); }	// disk: exponential in latitude
+			else sb = uniform(rng)*2-1;
+			double cb = sqrt(std::max(0.0,1-sb*sb)), x = cb*cos(l), y = cb*sin(l), z = sb;
+			dirs[k] = vec3(float(x),float(y*ct-z*st),float(y*st+z*ct));
+			double m = m_max+2.0*log10(uniform(rng)*(1-faint)+faint);
+			v[k].mag = int16_t(lround(m*1000.0));
+			v[k].color = uint8_t(lround(std::min(std::max((bv(rng)+0.4)/2.4,0.0),1.0)*255.0));
+			v[k].pad = 0;
+			encode( dirs[k], v[k].dir );
+		}
+		build( v, dirs );
+	}
+
+	bool load( const char* path )
+	{
+		FILE* fp = fopen( path, "rb" ); if(!fp) return false;
+		star_header h, ref;
+		fseek( fp, 0, SEEK_END ); long size = ftell( fp ); fseek( fp, 0, SEEK_SET );
+		bool ok = fread( &h, sizeof(h), 1, fp )==1&&memcmp(h.magic,ref.magic,4)==0&&h.cells_per_face>0&&h.cells_per_face<=256;
+		size_t ncells = ok ? size_t(FACES*h.cells_per_face*h.cells_per_face) : 0;
+		ok = ok&&size>=0&&uint64_t(size)==sizeof(h)+ncells*sizeof(star_cell)+uint64_t(h.count)*sizeof(star_t);	// bound the count by the file before allocating
+		if(ok)
+		{
+			cells_per_face = h.cells_per_face;
+			cells.resize(ncells); stars.resize(h.count);
+			ok = fread( cells.data(), sizeof(star_cell), cells.size(), fp )==cells.size()&&fread( stars.data(), sizeof(star_t), stars.size(), fp )==stars.size();
+			uint64_t next = 0;	// cells are draw ranges: contiguous, in order, and covering all stars
+			for( size_t k=0; ok&&k < cells.size(); k++ ){ ok = cells[k].first==next; next += cells[k].count; }
+			ok = ok&&next==h.count;
+		}
+		fclose( fp );
+		if(!ok){ printf( "%s(): %s is not a star catalogue\n", __func__, path ); stars.clear(); cells.clear(); return false; }
+		index_bounds();
+		return true;
+	}
+
+	bool save( const char* path ) const
+	{
+		FILE* fp = fopen( path, "wb" ); if(!fp){ printf( "%s(): unable to open %s\n", __func__, path ); return false; }
+		star_header h; h.cells_per_face = cells_per_face; h.count = uint32_t(stars.size());
+		fwrite( &h, sizeof(h), 1, fp );
+		fwrite( cells.data(), sizeof(star_cell), cells.size(), fp );
+		fwrite( stars.data(), sizeof(star_t), stars.size(), fp );
+		fclose( fp );
+		return true;
+	}
+
+	// after generate() or load(): the stars go to a static vertex buffer
+	bool init()
+	{
+		if(!(program=program_binaries().create( star_vert_source, star_frag_source ))){ printf( "%s(): failed to create the star program\n", __func__ ); return false; }
+		resolve_uniforms( program, u );
+		glGenVertexArrays( 1, &vao ); glGenBuffers( 1, &buffer );
+		if(!vao||!buffer){ printf( "%s(): failed to create the star buffers\n", __func__ ); return false; }
+		glBindVertexArray( vao );
+		glBindBuffer( GL_ARRAY_BUFFER, buffer );
+		glBufferData( GL_ARRAY_BUFFER, GLsizeiptr(sizeof(star_t)*stars.size()), stars.data(), GL_STATIC_DRAW );
+		glEnableVertexAttribArray(0); glVertexAttribPointer( 0, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(star_t), (void*) offsetof(star_t,dir) );
+		glEnableVertexAttribArray(1); glVertexAttribPointer( 1, 1, GL_SHORT, GL_FALSE, sizeof(star_t), (void*) offsetof(star_t,mag) );
+		glEnableVertexAttribArray(2); glVertexAttribPointer( 2, 1, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(star_t), (void*) offsetof(star_t,color) );
+		glBindVertexArray( 0 );
+		glBindBuffer( GL_ARRAY_BUFFER, 0 );
+		return true;
+	}
+
+	// first thing after clearing: stars neither test nor write depth, and add up
+	void draw( const mat4& view, const mat4& projection, bool cull )
+	{
+		stats = stats_t();
+		if(!enabled||!program||stars.empty()) return;
+		if(limit!=counted_limit) count_bright();
+
+		// only the rotation of the view applies; the near and far planes accept everything
+		mat4 rotation = view; rotation._14 = rotation._24 = rotation._34 = 0;
+		frustum_t f; f.extract( projection*rotation ); f.planes[4] = f.planes[5] = vec4(0,0,0,1);
+		if(cull) bounds.test( f ); else bounds.accept_all();
+
+		firsts.clear(); counts.clear();
+		for( size_t k=0; k < cells.size(); k++ )
+		{
+			if(!bounds.visible[k]||!bright[k]) continue;
+			stats.cells++; stats.stars += bright[k];
+			GLint first = GLint(cells[k].first);
+			if(!counts.empty()&&firsts.back()+counts.back()==first) counts.back() += GLsizei(bright[k]);	// the previous cell is drawn whole
+			else { firsts.push_back(first); counts.push_back(GLsizei(bright[k])); }
+		}
+		stats.ranges = int(firsts.size());
+		if(firsts.empty()) return;
+
+		GLboolean depth = glIsEnabled( GL_DEPTH_TEST ), blend = glIsEnabled( GL_BLEND );
+		glDisable( GL_DEPTH_TEST ); glDepthMask( GL_FALSE );
+		glEnable( GL_BLEND ); glBlendFunc( GL_ONE, GL_ONE );
+		glEnable( GL_PROGRAM_POINT_SIZE );
+		glUseProgram( program );
+		u.limit.set(limit); u.point_scale.set(point_scale);
+		glBindVertexArray( vao );
+		glMultiDrawArrays( GL_POINTS, firsts.data(), counts.data(), GLsizei(firsts.size()) );
+		glBindVertexArray( 0 );
+		glDisable( GL_PROGRAM_POINT_SIZE );
+		glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA ); if(!blend) glDisable( GL_BLEND );
+		glDepthMask( GL_TRUE ); if(depth) glEnable( GL_DEPTH_TEST );
+	}
+
+	void print_stats()
+	{
+		printf( "> stars: %lld of %d to magnitude %.1f from %d of %d cells in %d ranges of one draw\n", (long long) stats.stars, int(stars.size()), limit, stats.cells, int(cells.size()), stats.ranges );
+	}
+
+	void release()
+	{
+		if(program) glDeleteProgram( program );
+		if(vao) glDeleteVertexArrays( 1, &vao );
+		if(buffer) glDeleteBuffers( 1, &buffer );
+		program = vao = buffer = 0;
+	}
+
+protected:
+	// face axes of the cube: major, then the two spanning the face
+	static void face_axes( int f, vec3& m, vec3& u, vec3& v )
+	{
+		static const float a[FACES][9] = {
+			{1,0,0, 0,1,0, 0,0,1}, {-1,0,0, 0,-1,0, 0,0,1}, {0,1,0, -1,0,0, 0,0,1},
+			{0,-1,0, 1,0,0, 0,0,1}, {0,0,1, 1,0,0, 0,1,0}, {0,0,-1, 1,0,0, 0,-1,0} };
+		m = vec3(a[f][0],a[f][1],a[f][2]); u = vec3(a[f][3],a[f][4],a[f][5]); v = vec3(a[f][6],a[f][7],a[f][8]);
+	}
+
+	int cell_of( const vec3& d ) const
+	{
+		float ax=fabsf(d.x), ay=fabsf(d.y), az=fabsf(d.z);
+		int f = ax>=ay&&ax>=az ? (d.x>=0?0:1) : ay>=az ? (d.y>=0?2:3) : (d.z>=0?4:5);
+		vec3 m, u, v; face_axes( f, m, u, v );
+		float w = d.dot(m), s = atanf(d.dot(u)/w)*float(4/PI), t = atanf(d.dot(v)/w)*float(4/PI);	// equal-angle, in [-1,1]
+		int N = cells_per_face;
+		int i = std::min(N-1,std::max(0,int((s+1)*0.5f*N))), j = std::min(N-1,std::max(0,int((t+1)*0.5f*N)));
+		return (f*N+j)*N+i;
+	}
+
+	vec3 cell_point( int f, float i, float j ) const	// i, j in cells from the face's corner
+	{
+		vec3 m, u, v; face_axes( f, m, u, v );
+		float N = float(cells_per_face);
+		return (m+u*tanf((i/N*2-1)*float(PI/4))+v*tanf((j/N*2-1)*float(PI/4))).normalize();
+	}
+
+	static void encode( const vec3& d, uint16_t out[2] )
+	{
+		float s = fabsf(d.x)+fabsf(d.y)+fabsf(d.z), x = d.x/s, y = d.y/s;
+		if(d.z<0){ float ox = (1-fabsf(y))*(x>=0?1:-1), oy = (1-fabsf(x))*(y>=0?1:-1); x = ox; y = oy; }
+		out[0] = uint16_t(lroundf((x*0.5f+0.5f)*65535.0f)); out[1] = uint16_t(lroundf((y*0.5f+0.5f)*65535.0f));
+	}
+
+	// sort by cell, and by magnitude within each cell
+	void build( const std::vector<star_t>& v, const std::vector<vec3>& dirs )
+	{
+		auto t0 = std::chrono::steady_clock::now();
+		cells.assign(size_t(FACES*cells_per_face*cells_per_face),star_cell());
+		std::vector<int> key(v.size());
+		for( size_t k=0; k < v.size(); k++ ){ key[k] = cell_of( dirs[k] ); cells[size_t(key[k])].count++; }
+		uint32_t first = 0; for( auto& c : cells ){ c.first = first; first += c.count; c.count = 0; }
+		stars.resize(v.size());
+		for( size_t k=0; k < v.size(); k++ ){ star_cell& c = cells[size_t(key[k])]; stars[c.first+c.count++] = v[k]; }
+		for( auto& c : cells ) std::sort( stars.begin()+c.first, stars.begin()+c.first+c.count, []( const star_t& a, const star_t& b ){ return a.mag<b.mag; } );
+		index_bounds();
+		printf( "> star catalogue: %d stars indexed in %.1f ms\n", int(stars.size()), std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count()*1000.0 );
+	}
+
+	// a sphere on the unit sphere around each cell, through its farthest corner
+	void index_bounds()
+	{
+		bounds.clear(); counted_limit = NAN;
+		int N = cells_per_face;
+		for( int f=0; f < FACES; f++ ) for( int j=0; j < N; j++ ) for( int i=0; i < N; i++ )
+		{
+			vec3 c = cell_point( f, i+0.5f, j+0.5f );
+			float r = 0;
+			for( int k=0; k < 4; k++ ) r = std::max(r,(cell_point( f, float(i+(k&1)), float(j+(k>>1)) )-c).length());
+			bounds.push( c, r*1.05f );
+		}
+	}
+
+	// per cell, the prefix of stars at or above the limit
+	void count_bright()
+	{
+		int16_t m = int16_t(std::min(32767.0f,std::max(-32768.0f,limit*1000.0f)));
+		bright.resize(cells.size());
+		for( size_t k=0; k < cells.size(); k++ )
+		{
+			auto b = stars.begin()+cells[k].first;
+			bright[k] = uint32_t(std::upper_bound( b, b+cells[k].count, m, []( int16_t x, const star_t& s ){ return x<s.mag; } )-b);
+		}
+		counted_limit = limit;
+	}
+};
+
+#endif // __STARFIELD_H__
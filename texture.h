@@ -0,0 +1,668 @@
+#pragma once
+#ifndef __TEXTURE_H__
+#define __TEXTURE_H__
+
+#include "cgut.h"
+#include <stdint.h>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <map>
+#include <sys/stat.h>
+#if defined(__SSE2__)||defined(_M_X64)||(defined(_M_IX86_FP)&&_M_IX86_FP>=2)
+	#include <emmintrin.h>
+	#define TEXTURE_SSE2
+#endif
+#if !defined(TEXTURE_NO_LIBJPEG)&&defined(__has_include)	// libjpeg decodes JPEGs at a reduced scale; link with -ljpeg
+	#if __has_include(<jpeglib.h>)
+		#include <stdio.h>
+		#include <setjmp.h>
+		#include <jpeglib.h>
+		#define TEXTURE_LIBJPEG
+	#endif
+#endif
+
+//*************************************
+// image decoding bounded by the display resolution
+
+struct image_load_t
+{
+	std::string	path;
+	size_t		file_size = 0;		// bytes of the compressed file
+	ivec2		source;				// resolution stored in the file
+	ivec2		decoded;			// resolution after reduction
+	int			channels = 0;
+	size_t		decoded_size = 0;	// bytes of the returned image
+	size_t		full_size = 0;		// bytes of a full-resolution decode
+	size_t		peak = 0;			// bytes held by the loader at its peak
+};
+
+inline std::vector<image_load_t>& image_loads(){ static std::vector<image_load_t> v; return v; }
+inline std::mutex& image_loads_mutex(){ static std::mutex m; return m; }
+
+#ifdef TEXTURE_LIBJPEG
+// libjpeg error handler that returns to the decoder instead of calling exit()
+struct jpeg_error_t { jpeg_error_mgr mgr; jmp_buf env; };
+inline void jpeg_error_exit( j_common_ptr c ){ longjmp( ((jpeg_error_t*)c->err)->env, 1 ); }
+
+// decode a JPEG reduced by f (a power of two) and flipped vertically: libjpeg scales by up to 1/8
+// in the DCT domain, and the rest is box-filtered one scanline at a time, so only a scanline of the
+// scaled decode exists besides the result; null when libjpeg cannot decode it to gray or RGB
+inline image* load_jpeg( const char* path, int f, image_load_t& r )
+{
+	FILE* fp = fopen( path, "rb" ); if(!fp) return nullptr;
+	jpeg_decompress_struct cinfo; jpeg_error_t err;
+	unsigned char* volatile row = nullptr; unsigned* volatile sum = nullptr; image* volatile i = nullptr;
+	cinfo.err = jpeg_std_error( &err.mgr ); err.mgr.error_exit = jpeg_error_exit;
+	if(setjmp(err.env)){ jpeg_destroy_decompress( &cinfo ); fclose( fp ); free( row ); free( sum ); delete i; return nullptr; }
+	jpeg_create_decompress( &cinfo );
+	jpeg_stdio_src( &cinfo, fp );
+	jpeg_read_header( &cinfo, TRUE );
+	cinfo.out_color_space = cinfo.num_components==1 ? JCS_GRAYSCALE : JCS_RGB;	// CMYK fails here, and falls back to stb_image
+	cinfo.scale_num = 1; cinfo.scale_denom = unsigned(std::min(f,8));
+	jpeg_start_decompress( &cinfo );
+
+	int sw=int(cinfo.output_width), sh=int(cinfo.output_height), c=cinfo.output_components, g=f/int(cinfo.scale_denom);
+	int ow=std::max(sw/g,1), oh=std::max(sh/g,1);
+	size_t stride=size_t(sw)*c, ostride=size_t(ow)*c;
+	i = new image; i->width=ow; i->height=oh; i->channels=c;
+	i->ptr = (unsigned char*) malloc( size_t(oh)*ostride );
+	row = (unsigned char*) malloc( stride ); sum = (unsigned*) malloc( ostride*sizeof(unsigned) );
+	if(!i->ptr||!row||!sum) longjmp( err.env, 1 );
+
+	for( int oy=0; oy < oh; oy++ )
+	{
+		unsigned char* d = i->ptr+size_t(oh-1-oy)*ostride;
+		if(g==1){ JSAMPROW p=d; jpeg_read_scanlines( &cinfo, &p, 1 ); continue; }
+		memset( sum, 0, ostride*sizeof(unsigned) );
+		for( int y=0; y < g&&oy*g+y < sh; y++ )
+		{
+			JSAMPROW p=row; jpeg_read_scanlines( &cinfo, &p, 1 );
+			for( int ox=0; ox < ow; ox++ ) for( int x=0; x < g; x++ ) for( int k=0; k < c; k++ ) sum[ox*c+k] += row[(size_t(ox)*g+x)*c+k];
+		}
+		for( size_t k=0; k < ostride; k++ ) d[k] = (unsigned char)((sum[k]+g*g/2)/(g*g));
+	}
+	if(cinfo.output_scanline<cinfo.output_height) jpeg_abort_decompress( &cinfo );	// rows past the last whole band
+	else jpeg_finish_decompress( &cinfo );
+
+	r.source=ivec2(int(cinfo.image_width),int(cinfo.image_height)); r.decoded=ivec2(ow,oh); r.channels=c;
+	r.peak = size_t(oh)*ostride+(g>1?stride+ostride*sizeof(unsigned):0);
+	jpeg_destroy_decompress( &cinfo ); fclose( fp ); free( row ); free( sum );
+	return i;
+}
+#endif
+
+// decode an image so that neither side exceeds max_dim (0: no limit); the image is reduced
+// by a power-of-two factor and flipped vertically in the same pass, like cg_load_image().
+// JPEGs are decoded at the reduced scale by libjpeg when available; other formats go through
+// stb_image, which cannot decode at a reduced scale, so their full-resolution pixels exist
+// transiently inside stbi_load() before they are box-filtered
+inline image* load_image( const char* path, int max_dim=0 )
+{
+	image_load_t r; r.path = path;
+	struct stat st; if(stat(path,&st)==0) r.file_size = size_t(st.st_size);
+
+	int w, h, c; if(!stbi_info( path, &w, &h, &c )){ printf( "%s(): unable to load %s\n", __func__, path ); return nullptr; }
+	int f=1; while(max_dim>0&&(w/f>max_dim||h/f>max_dim)&&w/f>1&&h/f>1) f<<=1;
+	r.full_size = size_t(w)*h*c;
+
+	image* i = nullptr;
+#ifdef TEXTURE_LIBJPEG
+	i = load_jpeg( path, f, r );
+#endif
+	if(!i)
+	{
+		int ow=w/f, oh=h/f;
+		unsigned char* src = stbi_load( path, &w, &h, &c, 0 ); if(!src){ printf( "%s(): unable to decode %s\n", __func__, path ); return nullptr; }
+		size_t stride=size_t(w)*c, ostride=size_t(ow)*c;
+
+		i = new image; i->width=ow; i->height=oh; i->channels=c;
+		if(f==1)
+		{
+			// flip in place, and keep the decoded buffer
+			std::vector<unsigned char> row(stride);
+			for( int y=0; y < h/2; y++ )
+			{
+				unsigned char *a=src+y*stride, *b=src+(h-1-y)*stride;
+				memcpy(row.data(),a,stride); memcpy(a,b,stride); memcpy(b,row.data(),stride);
+			}
+			i->ptr = src;
+			r.peak = size_t(h)*stride+stride;
+		}
+		else
+		{
+			i->ptr = (unsigned char*) malloc( size_t(oh)*ostride );
+			if(!i->ptr){ printf( "%s(): out of memory for %s\n", __func__, path ); stbi_image_free( src ); delete i; return nullptr; }
+			std::vector<unsigned> sum(ostride);
+			for( int oy=0; oy < oh; oy++ )
+			{
+				std::fill( sum.begin(), sum.end(), 0u );
+				for( int y=oy*f, ye=y+f; y < ye; y++ )
+				{
+					const unsigned char* s = src+size_t(y)*stride;
+					for( int ox=0; ox < ow; ox++ ) for( int x=0; x < f; x++ ) for( int k=0; k < c; k++ ) sum[ox*c+k] += s[(size_t(ox)*f+x)*c+k];
+				}
+				unsigned char* d = i->ptr+size_t(oh-1-oy)*ostride;
+				for( size_t k=0; k < ostride; k++ ) d[k] = (unsigned char)((sum[k]+f*f/2)/(f*f));
+			}
+			stbi_image_free( src );
+			r.peak = size_t(h)*stride+size_t(oh)*ostride;
+		}
+		r.source=ivec2(w,h); r.decoded=ivec2(ow,oh); r.channels=c;
+	}
+
+	r.decoded_size=size_t(i->height)*i->width*i->channels;
+	std::lock_guard<std::mutex> lock(image_loads_mutex());
+	image_loads().push_back(r);
+	return i;
+}
+
+inline void print_image_load_report()
+{
+	std::lock_guard<std::mutex> lock(image_loads_mutex());
+	size_t file=0, decoded=0, full=0, peak=0;
+	printf( "[image loads]\n%-44s %9s %11s %11s %9s %9s %9s\n", "path", "file", "source", "decoded", "memory", "full", "peak" );
+	for( auto& r : image_loads() )
+	{
+		printf( "%-44s %7.1fKB %5dx%-5d %5dx%-5d %7.1fMB %7.1fMB %7.1fMB\n", r.path.c_str(), r.file_size/1024.0, r.source.x, r.source.y, r.decoded.x, r.decoded.y, r.decoded_size/1048576.0, r.full_size/1048576.0, r.peak/1048576.0 );
+		file+=r.file_size; decoded+=r.decoded_size; full=std::max(full,r.full_size); peak=std::max(peak,r.peak);
+	}
+	printf( "%-44s %7.1fKB %23s %7.1fMB %7.1fMB %7.1fMB\n\n", "total (full and peak: largest)", file/1024.0, "", decoded/1048576.0, full/1048576.0, peak/1048576.0 );
+}
+
+//*************************************
+// immutable texture storage and shared samplers
+
+inline int texture_mip_levels( int w, int h ){ int l=0; for( int k=w>h?w:h; k; k>>=1 ) l++; return l; }
+
+// whether each texture created here has a mip chain, so that binding picks a sampler it is complete with
+inline std::map<GLuint,bool>& texture_mipmapped(){ static std::map<GLuint,bool> m; return m; }
+
+// delete textures and forget their mip chains, so that a recycled name does not inherit a stale entry
+inline void delete_textures( GLsizei n, const GLuint* textures ){ for( GLsizei k=0; k < n; k++ ) texture_mipmapped().erase(textures[k]); glDeleteTextures( n, textures ); }
+
+inline void texture_formats( int channels, GLenum& internal_format, GLenum& format )
+{
+	internal_format = channels==1?GL_R8:channels==2?GL_RG8:channels==3?GL_RGB8:GL_RGBA8;
+	format = channels==1?GL_RED:channels==2?GL_RG:channels==3?GL_RGB:GL_RGBA;
+}
+
+// allocate the whole mip chain at once: glTexStorage2D where available (GL 4.2+);
+// otherwise, level 0 is allocated once and glGenerateMipmap allocates the rest in one go
+inline GLuint create_texture_storage( int w, int h, GLenum internal_format, GLenum format, bool mipmap=true )
+{
+	GLuint texture; glGenTextures( 1, &texture ); if(texture==0){ printf("%s(): failed in glGenTextures()\n", __func__ ); return 0; }
+	int levels = mipmap ? texture_mip_levels(w,h) : 1;
+	texture_mipmapped()[texture] = mipmap;
+	glBindTexture( GL_TEXTURE_2D, texture );
+	if(glTexStorage2D) glTexStorage2D( GL_TEXTURE_2D, levels, internal_format, w, h );
+	else
+	{
+		glTexImage2D( GL_TEXTURE_2D, 0, internal_format, w, h, 0, format, GL_UNSIGNED_BYTE, nullptr );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels-1 );	// complete without validation at draw time
+	}
+	return texture;
+}
+
+// upload an image into immutable storage; filtering and wrapping come from texture_sampler()
+inline GLuint create_texture( const image* i, bool mipmap=true )
+{
+	GLenum internal_format, format; texture_formats( i->channels, internal_format, format );
+	GLuint texture = create_texture_storage( i->width, i->height, internal_format, format, mipmap ); if(!texture) return 0;
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+	glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, i->width, i->height, format, GL_UNSIGNED_BYTE, i->ptr );
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+	if(mipmap&&glGenerateMipmap) glGenerateMipmap( GL_TEXTURE_2D );
+	return texture;
+}
+
+// the former mutable path of cg_create_texture(), kept only as a benchmark reference
+inline GLuint create_texture_mutable( const image* i, bool mipmap=true, GLenum wrap=GL_CLAMP_TO_EDGE, GLenum filter=GL_LINEAR )
+{
+	int w=i->width, h=i->height;
+	GLenum internal_format, format; texture_formats( i->channels, internal_format, format );
+	GLuint texture; glGenTextures( 1, &texture ); if(texture==0) return 0;
+	texture_mipmapped()[texture] = mipmap;
+	glBindTexture( GL_TEXTURE_2D, texture );
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+	glTexImage2D( GL_TEXTURE_2D, 0, internal_format, w, h, 0, format, GL_UNSIGNED_BYTE, i->ptr );
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+	if( mipmap )
+	{
+		int mip_levels = texture_mip_levels(w,h);
+		for( int l=1; l < mip_levels; l++ )
+			glTexImage2D( GL_TEXTURE_2D, l, internal_format, (w>>l)==0?1:(w>>l), (h>>l)==0?1:(h>>l), 0, format, GL_UNSIGNED_BYTE, nullptr );
+		if(glGenerateMipmap) glGenerateMipmap(GL_TEXTURE_2D);
+	}
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, !mipmap?filter:filter==GL_LINEAR?GL_LINEAR_MIPMAP_LINEAR:GL_NEAREST_MIPMAP_NEAREST );
+	return texture;
+}
+
+// bilinear resampling to an exact size and channel count (gray/RGB expand to RGBA with opaque alpha)
+inline image* resize_image( const image* src, int w, int h, int channels )
+{
+	if(!src||!src->ptr||w<=0||h<=0) return nullptr;
+	int sw=src->width, sh=src->height, sc=src->channels;
+	image* i = new image; i->width=w; i->height=h; i->channels=channels;
+	i->ptr = (unsigned char*) malloc( size_t(w)*h*channels ); if(!i->ptr){ delete i; return nullptr; }
+	for( int y=0; y < h; y++ )
+	{
+		float fy = std::max(0.0f,(y+0.5f)*sh/h-0.5f); int y0=std::min(int(fy),sh-1), y1=std::min(y0+1,sh-1); float ty=fy-y0;
+		for( int x=0; x < w; x++ )
+		{
+			float fx = std::max(0.0f,(x+0.5f)*sw/w-0.5f); int x0=std::min(int(fx),sw-1), x1=std::min(x0+1,sw-1); float tx=fx-x0;
+			const unsigned char *p00=src->ptr+(size_t(y0)*sw+x0)*sc, *p01=src->ptr+(size_t(y0)*sw+x1)*sc;
+			const unsigned char *p10=src->ptr+(size_t(y1)*sw+x0)*sc, *p11=src->ptr+(size_t(y1)*sw+x1)*sc;
+			unsigned char* d = i->ptr+(size_t(y)*w+x)*channels;
+			for( int k=0; k < channels; k++ )
+			{
+				int c = sc>=3 ? (k<sc?k:-1) : (k<3?0:sc==2?1:-1);	// replicate gray into RGB; missing alpha is opaque
+				if(c<0){ d[k]=255; continue; }
+				float v = (p00[c]*(1-tx)+p01[c]*tx)*(1-ty)+(p10[c]*(1-tx)+p11[c]*tx)*ty;
+				d[k] = (unsigned char)(v+0.5f);
+			}
+		}
+	}
+	return i;
+}
+
+// a 2D texture array from equally-sized images of the same channel count
+inline GLuint create_texture_array( const std::vector<image*>& layers, bool mipmap=true )
+{
+	if(layers.empty()||!layers[0]) return 0;
+	int w=layers[0]->width, h=layers[0]->height, n=int(layers.size());
+	GLenum internal_format, format; texture_formats( layers[0]->channels, internal_format, format );
+	int levels = mipmap ? texture_mip_levels(w,h) : 1;
+
+	GLuint texture; glGenTextures( 1, &texture ); if(texture==0){ printf("%s(): failed in glGenTextures()\n", __func__ ); return 0; }
+	texture_mipmapped()[texture] = mipmap;
+	glBindTexture( GL_TEXTURE_2D_ARRAY, texture );
+	if(glTexStorage3D) glTexStorage3D( GL_TEXTURE_2D_ARRAY, levels, internal_format, w, h, n );
+	else
+	{
+		glTexImage3D( GL_TEXTURE_2D_ARRAY, 0, internal_format, w, h, n, 0, format, GL_UNSIGNED_BYTE, nullptr );
+		glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels-1 );
+	}
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+	for( int l=0; l < n; l++ )
+	{
+		if(!layers[l]||layers[l]->width!=w||layers[l]->height!=h||layers[l]->channels!=layers[0]->channels){ printf("%s(): layer %d does not match layer 0\n", __func__, l ); continue; }
+		glTexSubImage3D( GL_TEXTURE_2D_ARRAY, 0, 0, 0, l, w, h, 1, format, GL_UNSIGNED_BYTE, layers[l]->ptr );
+	}
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+	if(mipmap&&glGenerateMipmap) glGenerateMipmap( GL_TEXTURE_2D_ARRAY );
+	glBindTexture( GL_TEXTURE_2D_ARRAY, 0 );
+	return texture;
+}
+
+// sampler objects shared by all textures of the same wrap/filter/mipmap setting
+inline GLuint texture_sampler( GLenum wrap=GL_CLAMP_TO_EDGE, GLenum filter=GL_LINEAR, bool mipmap=true )
+{
+	static std::map<uint64_t,GLuint> samplers;
+	uint64_t key = (uint64_t(wrap)<<33)|(uint64_t(filter)<<1)|(mipmap?1:0);
+	auto it = samplers.find(key); if(it!=samplers.end()) return it->second;
+
+	GLuint sampler; glGenSamplers( 1, &sampler ); if(sampler==0){ printf("%s(): failed in glGenSamplers()\n", __func__ ); return 0; }
+	glSamplerParameteri( sampler, GL_TEXTURE_WRAP_S, wrap );
+	glSamplerParameteri( sampler, GL_TEXTURE_WRAP_T, wrap );
+	glSamplerParameteri( sampler, GL_TEXTURE_MAG_FILTER, filter );
+	glSamplerParameteri( sampler, GL_TEXTURE_MIN_FILTER, !mipmap?filter:filter==GL_LINEAR?GL_LINEAR_MIPMAP_LINEAR:GL_NEAREST_MIPMAP_NEAREST );
+	return samplers[key] = sampler;
+}
+
+// bind a texture with the shared sampler matching its mip chain; textures not created here
+// (e.g., by cg_create_texture) get the non-mipmapped sampler, which is complete for any texture
+inline void bind_texture( GLuint unit, GLenum target, GLuint texture, GLenum wrap=GL_CLAMP_TO_EDGE, GLenum filter=GL_LINEAR )
+{
+	auto it = texture_mipmapped().find(texture);
+	glActiveTexture( GL_TEXTURE0+unit );
+	glBindTexture( target, texture );
+	glBindSampler( unit, texture_sampler( wrap, filter, it!=texture_mipmapped().end()&&it->second ) );
+}
+
+//*************************************
+// load-time channel packing
+
+// merge a color image and a (gray) alpha image into one RGBA image; the alpha image
+// is resampled to the color image by nearest lookup when their sizes differ
+inline image* pack_rgba( const image* color, const image* alpha )
+{
+	if(!color||!alpha||!color->ptr||!alpha->ptr) return nullptr;
+	int w=color->width, h=color->height, cc=color->channels, ac=alpha->channels;
+	image* i = new image; i->width=w; i->height=h; i->channels=4;
+	i->ptr = (unsigned char*) malloc( size_t(w)*h*4 ); if(!i->ptr){ delete i; return nullptr; }
+	for( int y=0; y < h; y++ )
+	{
+		const unsigned char* c = color->ptr + size_t(y)*w*cc;
+		const unsigned char* a = alpha->ptr + size_t(y*alpha->height/h)*alpha->width*ac;
+		unsigned char* d = i->ptr + size_t(y)*w*4;
+		for( int x=0; x < w; x++, c+=cc, d+=4 )
+		{
+			d[0] = c[0]; d[1] = cc>2?c[1]:c[0]; d[2] = cc>2?c[2]:c[0];
+			d[3] = a[size_t(x*alpha->width/w)*ac];
+		}
+	}
+	return i;
+}
+
+//*************************************
+// tangent-space normal maps derived from height (bump) images
+
+// encode a normal of slopes (gx,gy) scaled by strength into RGB bytes
+inline void encode_normal( float gx, float gy, float strength, unsigned char* d )
+{
+	float nx=-gx*strength, ny=-gy*strength, inv=1.0f/sqrtf(nx*nx+ny*ny+1.0f);
+	d[0] = (unsigned char)((nx*inv*0.5f+0.5f)*255.0f+0.5f);
+	d[1] = (unsigned char)((ny*inv*0.5f+0.5f)*255.0f+0.5f);
+	d[2] = (unsigned char)((inv*0.5f+0.5f)*255.0f+0.5f);
+}
+
+// Sobel gradients of a height image (luminance for color images); x wraps around as in
+// the equirectangular planet maps, y is clamped at the poles
+inline image* derive_normal_map( const image* height, float strength=2.0f )
+{
+	if(!height||!height->ptr) return nullptr;
+	int w=height->width, h=height->height, c=height->channels;
+	std::vector<float> lum(size_t(w)*h);
+	for( size_t k=0, n=lum.size(); k < n; k++ )
+	{
+		const unsigned char* p = height->ptr+k*c;
+		lum[k] = (c>=3 ? 0.299f*p[0]+0.587f*p[1]+0.114f*p[2] : float(p[0]))/255.0f;
+	}
+
+	image* i = new image; i->width=w; i->height=h; i->channels=3;
+	i->ptr = (unsigned char*) malloc( size_t(w)*h*3 ); if(!i->ptr){ delete i; return nullptr; }
+	for( int y=0; y < h; y++ )
+	{
+		const float* r0 = &lum[size_t(y>0?y-1:0)*w];
+		const float* r1 = &lum[size_t(y)*w];
+		const float* r2 = &lum[size_t(y<h-1?y+1:h-1)*w];
+		unsigned char* d = i->ptr+size_t(y)*w*3;
+		auto scalar = [&]( int x )
+		{
+			int l=x>0?x-1:w-1, r=x<w-1?x+1:0;
+			float gx = (r0[r]+2*r1[r]+r2[r])-(r0[l]+2*r1[l]+r2[l]);
+			float gy = (r2[l]+2*r2[x]+r2[r])-(r0[l]+2*r0[x]+r0[r]);
+			encode_normal( gx, gy, strength, d+x*3 );
+		};
+		int x=1; scalar(0);
+#ifdef TEXTURE_SSE2
+		const __m128 two=_mm_set1_ps(2.0f), one=_mm_set1_ps(1.0f), half=_mm_set1_ps(0.5f), three_half=_mm_set1_ps(1.5f), scale=_mm_set1_ps(127.5f), s=_mm_set1_ps(-strength);
+		for( ; x+4 < w; x+=4 )
+		{
+			__m128 l0=_mm_loadu_ps(r0+x-1), m0=_mm_loadu_ps(r0+x), q0=_mm_loadu_ps(r0+x+1);
+			__m128 l1=_mm_loadu_ps(r1+x-1),                         q1=_mm_loadu_ps(r1+x+1);
+			__m128 l2=_mm_loadu_ps(r2+x-1), m2=_mm_loadu_ps(r2+x), q2=_mm_loadu_ps(r2+x+1);
+			__m128 gx = _mm_sub_ps( _mm_add_ps(_mm_add_ps(q0,q2),_mm_mul_ps(two,q1)), _mm_add_ps(_mm_add_ps(l0,l2),_mm_mul_ps(two,l1)) );
+			__m128 gy = _mm_sub_ps( _mm_add_ps(_mm_add_ps(l2,q2),_mm_mul_ps(two,m2)), _mm_add_ps(_mm_add_ps(l0,q0),_mm_mul_ps(two,m0)) );
+			__m128 nx=_mm_mul_ps(gx,s), ny=_mm_mul_ps(gy,s);
+			__m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx,nx),_mm_mul_ps(ny,ny)),one);
+			__m128 inv = _mm_rsqrt_ps(len2);	// one Newton step refines the estimate to ~1e-6
+			inv = _mm_mul_ps(inv,_mm_sub_ps(three_half,_mm_mul_ps(_mm_mul_ps(half,len2),_mm_mul_ps(inv,inv))));
+			__m128i ix = _mm_cvtps_epi32(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(nx,inv),one),scale));
+			__m128i iy = _mm_cvtps_epi32(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(ny,inv),one),scale));
+			__m128i iz = _mm_cvtps_epi32(_mm_mul_ps(_mm_add_ps(inv,one),scale));
+			alignas(16) int bx[4], by[4], bz[4];
+			_mm_store_si128((__m128i*)bx,ix); _mm_store_si128((__m128i*)by,iy); _mm_store_si128((__m128i*)bz,iz);
+			for( int k=0; k < 4; k++ ){ unsigned char* p=d+(x+k)*3; p[0]=(unsigned char)bx[k]; p[1]=(unsigned char)by[k]; p[2]=(unsigned char)bz[k]; }
+		}
+#endif
+		for( ; x < w; x++ ) scalar(x);
+	}
+	return i;
+}
+
+// derive a normal map from a height image, reusing "<height_path>.nrm" when it was
+// baked from the same source file with the same strength and size limit
+inline image* load_normal_map( const char* height_path, float strength=2.0f, int max_dim=0 )
+{
+	struct header_t { char magic[4]; int width, height; float strength; int max_dim; long long src_size, src_time; };
+	struct stat st; if(stat(height_path,&st)!=0){ printf( "%s(): unable to find %s\n", __func__, height_path ); return nullptr; }
+	std::string cache_path = std::string(height_path)+".nrm";
+
+	header_t hd;
+	FILE* fp = fopen( cache_path.c_str(), "rb" );
+	if(fp)
+	{
+		image* i = nullptr;
+		if(fread(&hd,sizeof(hd),1,fp)==1&&memcmp(hd.magic,"NRM2",4)==0&&hd.strength==strength&&hd.max_dim==max_dim&&hd.src_size==(long long)st.st_size&&hd.src_time==(long long)st.st_mtime)
+		{
+			size_t size = size_t(hd.width)*hd.height*3;
+			i = new image; i->width=hd.width; i->height=hd.height; i->channels=3;
+			i->ptr = (unsigned char*) malloc(size);
+			if(!i->ptr||fread(i->ptr,1,size,fp)!=size){ delete i; i=nullptr; }
+		}
+		fclose(fp);
+		if(i) return i;
+	}
+
+	image* height = load_image( height_path, max_dim ); if(!height) return nullptr;
+	image* i = derive_normal_map( height, strength );
+	delete height; if(!i) return nullptr;
+
+	memset(&hd,0,sizeof(hd));	// no stray padding bytes in the file
+	memcpy(hd.magic,"NRM2",4); hd.width=i->width; hd.height=i->height; hd.strength=strength; hd.max_dim=max_dim;
+	hd.src_size=(long long)st.st_size; hd.src_time=(long long)st.st_mtime;
+	if((fp=fopen( cache_path.c_str(), "wb" )))
+	{
+		fwrite(&hd,sizeof(hd),1,fp);
+		fwrite(i->ptr,1,size_t(i->width)*i->height*3,fp);
+		fclose(fp);
+	}
+	return i;
+}
+
+//*************************************
+// per-frame statistics of texture uploads
+struct upload_stats_t
+{
+	int		textures = 0;	// number of textures staged in this frame
+	size_t	bytes = 0;		// bytes copied into pixel unpack buffers
+	double	time = 0.0;		// seconds spent inside upload calls
+};
+
+//*************************************
+// asynchronous texture uploader: decoded images are staged through a ring of
+// pixel unpack buffers (PBOs), and each copy is fenced so that a PBO is reused
+// only after the GPU has consumed it; a texture replaces its target only when
+// its copy has been retired, so draws never wait for an upload in flight
+struct texture_uploader
+{
+	static const int RING = 3;			// number of pixel unpack buffers in flight
+	size_t	frame_budget = 16 << 20;	// max bytes staged per frame (0: unlimited)
+	int		max_dim = 0;				// max texture width/height at decoding (0: unlimited)
+
+	struct request_t
+	{
+		std::string	path;
+		GLuint*		target = nullptr;	// texture handle to be replaced
+		bool		mipmap = true;
+		image*		img = nullptr;		// decoded image; null until decoded
+	};
+
+	struct slot_t
+	{
+		GLuint		pbo = 0;
+		GLsizeiptr	capacity = 0;
+		GLsync		fence = nullptr;
+		GLuint		texture = 0;
+		GLuint*		target = nullptr;
+		bool		mipmap = true;
+	};
+
+	slot_t					slots[RING];
+	int						head = 0;
+	std::deque<request_t>	pending;		// decoded, waiting for a free slot
+	upload_stats_t			stats;			// stats of the current frame
+	upload_stats_t			last;			// stats of the previous frame
+
+	// background decoder
+	std::thread				worker;
+	std::mutex				mtx;
+	std::condition_variable	cv;
+	std::deque<request_t>	decode_queue;
+	std::deque<request_t>	decoded;
+	int						in_flight = 0;	// requested, and not yet in decoded (or failed)
+	bool					quit = false;
+
+	bool init()
+	{
+		for( auto& s : slots ){ glGenBuffers( 1, &s.pbo ); if(!s.pbo){ printf( "%s(): failed in glGenBuffers()\n", __func__ ); return false; } }
+		worker = std::thread( [this](){ decode_loop(); } );
+		return true;
+	}
+
+	// decode on the calling thread, and stage the copy on the next update()
+	bool load( const char* path, GLuint* target, bool mipmap=true )
+	{
+		return load( load_image( path, max_dim ), path, target, mipmap );
+	}
+
+	// stage an image decoded (or packed) by the caller; the uploader takes its ownership
+	bool load( image* i, const char* name, GLuint* target, bool mipmap=true )
+	{
+		if(!i) return false;
+		request_t r; r.path=name; r.target=target; r.mipmap=mipmap; r.img=i;
+		pending.push_back(r);
+		return true;
+	}
+
+	// decode on the worker thread; the target keeps its old texture until the new one is retired
+	void request( const char* path, GLuint* target, bool mipmap=true )
+	{
+		request_t r; r.path=path; r.target=target; r.mipmap=mipmap;
+		{ std::lock_guard<std::mutex> lock(mtx); decode_queue.push_back(r); in_flight++; }
+		cv.notify_one();
+	}
+
+	bool busy()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if(in_flight||!decoded.empty()||!pending.empty()) return true;	// in_flight covers a decode in progress
+		for( auto& s : slots ) if(s.fence) return true;
+		return false;
+	}
+
+	// per-frame update: retire finished copies, then stage new ones within the budget
+	void update( bool blocking=false )
+	{
+		last = stats; stats = upload_stats_t();
+		double t0 = glfwGetTime();
+
+		// collect images decoded by the worker
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			while(!decoded.empty()){ pending.push_back(decoded.front()); decoded.pop_front(); }
+		}
+
+		for( auto& s : slots ) retire( s, false );
+
+		glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+		while(!pending.empty())
+		{
+			slot_t& s = slots[head];
+			if(s.fence&&!retire(s,blocking)) break;	// the ring is full: continue in the next frame
+			size_t size = size_t(pending.front().img->width)*pending.front().img->height*pending.front().img->channels;
+			if(!blocking&&frame_budget&&stats.textures&&stats.bytes+size>frame_budget) break;
+			stage( s, pending.front() );
+			pending.pop_front();
+			head = (head+1)%RING;
+		}
+		glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+
+		if(blocking) for( auto& s : slots ) retire( s, true );
+		stats.time = glfwGetTime()-t0;
+	}
+
+	// block until every pending upload has been published
+	void flush()
+	{
+		while(busy()){ update(true); std::this_thread::yield(); }
+	}
+
+	void release()
+	{
+		if(worker.joinable())
+		{
+			{ std::lock_guard<std::mutex> lock(mtx); quit=true; }
+			cv.notify_one(); worker.join();
+		}
+		for( auto& r : decode_queue ) delete r.img;
+		for( auto& r : decoded ) delete r.img;
+		for( auto& r : pending ) delete r.img;
+		decode_queue.clear(); decoded.clear(); pending.clear();
+		in_flight = 0;
+		for( auto& s : slots )
+		{
+			if(s.fence){ glDeleteSync(s.fence); s.fence=nullptr; }
+			if(s.texture){ delete_textures(1,&s.texture); s.texture=0; }
+			if(s.pbo){ glDeleteBuffers(1,&s.pbo); s.pbo=0; }
+		}
+	}
+
+protected:
+	void decode_loop()
+	{
+		for(;;)
+		{
+			request_t r;
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				cv.wait( lock, [this](){ return quit||!decode_queue.empty(); } );
+				if(quit) return;
+				r = decode_queue.front(); decode_queue.pop_front();
+			}
+			r.img = load_image( r.path.c_str(), max_dim );
+			if(!r.img) printf( "%s(): unable to decode %s\n", __func__, r.path.c_str() );
+			std::lock_guard<std::mutex> lock(mtx);
+			if(r.img) decoded.push_back(r);
+			in_flight--;
+		}
+	}
+
+	// copy an image into the slot's PBO and issue the texture copy from it
+	void stage( slot_t& s, request_t& r )
+	{
+		image* i = r.img;
+		int w=i->width, h=i->height, c=i->channels;
+		GLsizeiptr size = GLsizeiptr(w)*h*c;
+		GLenum internal_format, format; texture_formats( c, internal_format, format );
+
+		glBindBuffer( GL_PIXEL_UNPACK_BUFFER, s.pbo );
+		if(size>s.capacity){ glBufferData( GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW ); s.capacity=size; }
+		void* dst = glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT|GL_MAP_INVALIDATE_BUFFER_BIT );
+		if(dst){ memcpy( dst, i->ptr, size ); glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER ); }
+
+		s.texture = create_texture_storage( w, h, internal_format, format, r.mipmap );
+		if(dst) glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, w, h, format, GL_UNSIGNED_BYTE, nullptr ); // sourced from the bound PBO
+		glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+		if(!dst) printf( "%s(): failed to map the pixel unpack buffer for %s\n", __func__, r.path.c_str() );
+
+		if(r.mipmap&&glGenerateMipmap) glGenerateMipmap( GL_TEXTURE_2D );
+
+		s.fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+		s.target = r.target;
+		s.mipmap = r.mipmap;
+		stats.textures++;
+		stats.bytes += size;
+		delete i; r.img = nullptr;
+	}
+
+	// publish the slot's texture once its copy has completed; returns true when the slot is free
+	bool retire( slot_t& s, bool wait )
+	{
+		if(!s.fence) return true;
+		GLenum e = glClientWaitSync( s.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait?GLuint64(1000000000):0 );
+		if(e!=GL_ALREADY_SIGNALED&&e!=GL_CONDITION_SATISFIED) return false;
+		glDeleteSync( s.fence ); s.fence = nullptr;
+		if(s.target){ if(*s.target) delete_textures( 1, s.target ); *s.target = s.texture; }
+		s.texture = 0; s.target = nullptr;
+		return true;
+	}
+};
+
+#endif // __TEXTURE_H__
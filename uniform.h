@@ -0,0 +1,153 @@
+#pragma once
+#ifndef __UNIFORM_H__
+#define __UNIFORM_H__
+
+#include "cgut.h"
+#include <map>
+
+//*************************************
+// counters of uniform uploads
+struct uniform_stats_t
+{
+	int		calls = 0;		// glUniform* calls issued
+	int		skipped = 0;	// uploads skipped because the value was unchanged
+	int		blocks = 0;		// uniform buffer updates
+};
+
+inline uniform_stats_t& uniform_stats(){ static uniform_stats_t s; return s; }			// current frame
+inline uniform_stats_t& uniform_stats_last(){ static uniform_stats_t s; return s; }	// previous frame
+
+// call once per frame, after render(), to roll the counters over
+inline void uniform_frame_end(){ uniform_stats_last() = uniform_stats(); uniform_stats() = uniform_stats_t(); }
+
+//*************************************
+// a uniform whose location is resolved once after linking; uploads are skipped
+// when the value equals the last one uploaded to the same location, so the program
+// must be current whenever set() is called
+struct uniform_t
+{
+	const char*	name;
+	GLint		loc = -1;
+	GLenum		type = 0;
+	GLint		size = 0;
+	bool		valid = false;	// cache holds the value in the program
+	float		cache[16];
+
+	uniform_t( const char* name ):name(name){}
+	operator bool() const { return loc>-1; }
+
+	void set( int v ){			if(dirty(&v,sizeof(v))) glUniform1i( loc, v ); }
+	void set( bool v ){			set(int(v)); }
+	void set( float v ){		if(dirty(&v,sizeof(v))) glUniform1f( loc, v ); }
+	void set( const vec2& v ){	if(dirty(&v,sizeof(v))) glUniform2fv( loc, 1, v ); }
+	void set( const vec3& v ){	if(dirty(&v,sizeof(v))) glUniform3fv( loc, 1, v ); }
+	void set( const vec4& v ){	if(dirty(&v,sizeof(v))) glUniform4fv( loc, 1, v ); }
+	void set( const mat4& m ){	if(dirty(&m,sizeof(m))) glUniformMatrix4fv( loc, 1, GL_TRUE, m ); }
+
+protected:
+	bool dirty( const void* v, size_t n )
+	{
+		if(loc<0) return false;
+		if(valid&&memcmp(cache,v,n)==0){ uniform_stats().skipped++; return false; }
+		memcpy(cache,v,n); valid=true;
+		uniform_stats().calls++;
+		return true;
+	}
+};
+
+//*************************************
+// reflect the active uniforms of a linked program, and resolve a list of uniform_t against them;
+// uniforms that are inactive (or live in uniform blocks) keep loc=-1 and are never uploaded
+inline void resolve_uniforms( GLuint program, uniform_t* u, size_t n )
+{
+	struct active_t { GLint loc; GLenum type; GLint size; };
+	std::map<std::string,active_t> active;
+
+	GLint count=0, max_length=0;
+	glGetProgramiv( program, GL_ACTIVE_UNIFORMS, &count );
+	glGetProgramiv( program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length );
+	std::vector<char> name(size_t(max_length)+1);
+	for( GLint k=0; k < count; k++ )
+	{
+		GLsizei length=0; active_t a;
+		glGetActiveUniform( program, GLuint(k), GLsizei(name.size()), &length, &a.size, &a.type, name.data() );
+		std::string s(name.data(),size_t(length));
+		if(s.size()>3&&s.compare(s.size()-3,3,"[0]")==0) s.resize(s.size()-3);
+		a.loc = glGetUniformLocation( program, s.c_str() );
+		active[s] = a;
+	}
+
+	for( size_t k=0; k < n; k++ )
+	{
+		auto it = active.find(u[k].name);
+		u[k].loc = it==active.end() ? -1 : it->second.loc;
+		u[k].type = it==active.end() ? 0 : it->second.type;
+		u[k].size = it==active.end() ? 0 : it->second.size;
+		u[k].valid = false;
+	}
+}
+
+// T is a struct made only of uniform_t members
+template <class T> inline void resolve_uniforms( GLuint program, T& u )
+{
+	static_assert( sizeof(T)%sizeof(uniform_t)==0, "uniform structs must consist of uniform_t only" );
+	resolve_uniforms( program, reinterpret_cast<uniform_t*>(&u), sizeof(T)/sizeof(uniform_t) );
+}
+
+//*************************************
+// std140 uniform blocks shared by all programs; a program opts in by declaring
+//   layout(std140, row_major) uniform Camera { mat4 view_matrix; mat4 projection_matrix; };
+//   layout(std140) uniform Light { vec4 light_position, Ia, Id, Is; };
+//   layout(std140) uniform Material { vec4 Ka, Kd, Ks; float shininess; };
+// block members are not plain uniforms, so their uniform_t stay unresolved and upload nothing
+enum { CAMERA_BLOCK=0, LIGHT_BLOCK=1, MATERIAL_BLOCK=2 };	// binding points
+
+struct camera_block		{ mat4 view_matrix, projection_matrix; };
+struct light_block		{ vec4 light_position, Ia, Id, Is; };
+struct material_block	{ vec4 Ka, Kd, Ks; float shininess, pad[3] = { 0, 0, 0 }; };
+
+template <class T> struct uniform_block_t
+{
+	const char*	name;
+	GLuint		binding;
+	GLuint		buffer = 0;
+	T			data = T();
+	bool		dirty = true;
+
+	uniform_block_t( const char* name, GLuint binding ):name(name),binding(binding){}
+
+	bool init()
+	{
+		glGenBuffers( 1, &buffer ); if(!buffer){ printf( "%s(): failed in glGenBuffers()\n", __func__ ); return false; }
+		glBindBuffer( GL_UNIFORM_BUFFER, buffer );
+		glBufferData( GL_UNIFORM_BUFFER, sizeof(T), nullptr, GL_DYNAMIC_DRAW );
+		glBindBufferBase( GL_UNIFORM_BUFFER, binding, buffer );
+		glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+		return true;
+	}
+
+	// connect the program's block of the same name to the binding point; false if not declared
+	bool attach( GLuint program )
+	{
+		GLuint index = glGetUniformBlockIndex( program, name ); if(index==GL_INVALID_INDEX) return false;
+		glUniformBlockBinding( program, index, binding );
+		return true;
+	}
+
+	void set( const T& v ){ if(memcmp(&data,&v,sizeof(T))!=0){ data=v; dirty=true; } }
+
+	// upload only when the data has changed since the last upload
+	void update()
+	{
+		if(!dirty||!buffer) return;
+		glBindBuffer( GL_UNIFORM_BUFFER, buffer );
+		glBufferSubData( GL_UNIFORM_BUFFER, 0, sizeof(T), &data );
+		glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+		dirty = false;
+		uniform_stats().blocks++;
+	}
+
+	void release(){ if(buffer) glDeleteBuffers( 1, &buffer ); buffer=0; }
+};
+
+#endif // __UNIFORM_H__